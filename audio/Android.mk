@@ -23,9 +23,29 @@ LOCAL_SRC_FILES := \
 LOCAL_C_INCLUDES += \
 	external/tinyalsa/include \
 	$(call include-path-for, audio-utils) \
+	$(call include-path-for, audio-effects) \
 	$(call include-path-for, audio-route)
 LOCAL_SHARED_LIBRARIES := liblog libcutils libtinyalsa libaudioutils libaudioroute
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
 
+
+# Replays the traces of tests/traces against the HAL on a simulated PCM
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio_hw_grouper_replay_test
+LOCAL_SRC_FILES := \
+	tests/audio_hw_replay_test.cpp \
+	tests/audio_hw_sim.c \
+	tests/sim_pcm.c
+LOCAL_C_INCLUDES += \
+	external/tinyalsa/include \
+	$(call include-path-for, audio-utils) \
+	$(call include-path-for, audio-effects) \
+	$(call include-path-for, audio-route)
+LOCAL_CFLAGS += -DAUDIO_TRACE_DIR=\"$(LOCAL_PATH)/tests/traces\"
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_NATIVE_TEST)
@@ -19,7 +19,10 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
 
@@ -28,12 +31,14 @@
 #include <cutils/str_parms.h>
 
 #include <hardware/audio.h>
+#include <hardware/audio_effect.h>
 #include <hardware/hardware.h>
 
 #include <system/audio.h>
 
 #include <tinyalsa/asoundlib.h>
 
+#include <audio_effects/effect_aec.h>
 #include <audio_utils/resampler.h>
 #include <audio_route/audio_route.h>
 
@@ -47,15 +52,28 @@
 #define OUT_SHORT_PERIOD_COUNT 2
 #define OUT_LONG_PERIOD_COUNT 8
 #define OUT_SAMPLING_RATE 44100
+#define OUT_SAMPLING_RATE_48000 48000
 
 #define IN_PERIOD_SIZE 1024
-#define IN_PERIOD_SIZE_LOW_LATENCY 512
+#define IN_PERIOD_SIZE_LOW_LATENCY 256
 #define IN_PERIOD_COUNT 2
+#define IN_PERIOD_COUNT_LOW_LATENCY 4
 #define IN_SAMPLING_RATE 44100
+#define IN_SAMPLING_RATE_48000 48000
 
 #define SCO_PERIOD_SIZE 256
 #define SCO_PERIOD_COUNT 4
 #define SCO_SAMPLING_RATE 8000
+#define SCO_WB_SAMPLING_RATE 16000
+
+/* echo reference history, in mono frames at the output PCM rate (~186 ms at 44.1 kHz) */
+#define ECHO_REF_FRAMES 8192
+
+/* HAL call trace, enabled at boot with setprop audio.grouper.trace 1 */
+#define AUDIO_TRACE_PROPERTY "audio.grouper.trace"
+#define AUDIO_TRACE_FILE "/data/misc/audio/audio_hal_trace.txt"
+/* records buffered before the trace is flushed, it is also flushed on standby */
+#define AUDIO_TRACE_FLUSH_RECORDS 256
 
 /* minimum sleep time in out_write() when write threshold is not reached */
 #define MIN_WRITE_SLEEP_US 2000
@@ -77,6 +95,15 @@ struct pcm_config pcm_config_out = {
     .start_threshold = OUT_PERIOD_SIZE * OUT_SHORT_PERIOD_COUNT,
 };
 
+struct pcm_config pcm_config_out_48000 = {
+    .channels = 2,
+    .rate = OUT_SAMPLING_RATE_48000,
+    .period_size = OUT_PERIOD_SIZE,
+    .period_count = OUT_LONG_PERIOD_COUNT,
+    .format = PCM_FORMAT_S16_LE,
+    .start_threshold = OUT_PERIOD_SIZE * OUT_SHORT_PERIOD_COUNT,
+};
+
 struct pcm_config pcm_config_in = {
     .channels = 2,
     .rate = IN_SAMPLING_RATE,
@@ -91,10 +118,30 @@ struct pcm_config pcm_config_in_low_latency = {
     .channels = 2,
     .rate = IN_SAMPLING_RATE,
     .period_size = IN_PERIOD_SIZE_LOW_LATENCY,
+    .period_count = IN_PERIOD_COUNT_LOW_LATENCY,
+    .format = PCM_FORMAT_S16_LE,
+    .start_threshold = 1,
+    .stop_threshold = (IN_PERIOD_SIZE_LOW_LATENCY * IN_PERIOD_COUNT_LOW_LATENCY),
+};
+
+struct pcm_config pcm_config_in_48000 = {
+    .channels = 2,
+    .rate = IN_SAMPLING_RATE_48000,
+    .period_size = IN_PERIOD_SIZE,
     .period_count = IN_PERIOD_COUNT,
     .format = PCM_FORMAT_S16_LE,
     .start_threshold = 1,
-    .stop_threshold = (IN_PERIOD_SIZE_LOW_LATENCY * IN_PERIOD_COUNT),
+    .stop_threshold = (IN_PERIOD_SIZE * IN_PERIOD_COUNT),
+};
+
+struct pcm_config pcm_config_in_low_latency_48000 = {
+    .channels = 2,
+    .rate = IN_SAMPLING_RATE_48000,
+    .period_size = IN_PERIOD_SIZE_LOW_LATENCY,
+    .period_count = IN_PERIOD_COUNT_LOW_LATENCY,
+    .format = PCM_FORMAT_S16_LE,
+    .start_threshold = 1,
+    .stop_threshold = (IN_PERIOD_SIZE_LOW_LATENCY * IN_PERIOD_COUNT_LOW_LATENCY),
 };
 
 struct pcm_config pcm_config_sco = {
@@ -105,6 +152,49 @@ struct pcm_config pcm_config_sco = {
     .format = PCM_FORMAT_S16_LE,
 };
 
+struct pcm_config pcm_config_sco_wb = {
+    .channels = 1,
+    .rate = SCO_WB_SAMPLING_RATE,
+    .period_size = SCO_PERIOD_SIZE,
+    .period_count = SCO_PERIOD_COUNT,
+    .format = PCM_FORMAT_S16_LE,
+};
+
+/*
+ * Single producer ring of the mono mix that is handed to the output PCM.
+ * out_write() is the only writer; readers keep their own position and
+ * never modify the ring, so no lock is shared between the playback and
+ * capture paths. The anchor maps a ring position to the CLOCK_MONOTONIC
+ * time at which that frame is expected to reach the DAC and is published
+ * under a sequence count.
+ */
+struct echo_ref_ring {
+    int16_t buffer[ECHO_REF_FRAMES];
+    atomic_uint write_pos;      /* total frames published, wraps */
+    atomic_uint seq;            /* odd while the anchor is being updated */
+    atomic_uint anchor_pos;
+    atomic_llong anchor_ns;
+    atomic_uint rate;
+    atomic_int readers;         /* input streams with an AEC attached */
+};
+
+/*
+ * One line per HAL call, prefixed with the microseconds elapsed since the
+ * trace was opened (CLOCK_MONOTONIC):
+ *   <us> W <bytes> <kernel_frames> <threshold> <sleep_us> <duration_us> <ret>
+ *   <us> R <bytes> <ret>
+ *   <us> PD|PO|PI <kvpairs>     device, output and input set_parameters
+ *   <us> SO|SI                  output and input standby
+ *   <us> OO|OI <rate> <flags>   output and input stream opened
+ * kernel_frames is -1 when the kernel fill level could not be read.
+ */
+struct audio_trace {
+    pthread_mutex_t lock;
+    FILE *file;
+    int64_t start_ns;
+    unsigned int records;       /* written since the last flush */
+};
+
 struct audio_device {
     struct audio_hw_device hw_device;
 
@@ -116,9 +206,13 @@ struct audio_device {
     struct audio_route *ar;
     int orientation;
     bool screen_off;
+    bool bt_wb_sco_on;  /* mSBC (16 kHz) SCO link, takes effect at the next SCO start */
 
     struct stream_out *active_out;
     struct stream_in *active_in;
+
+    struct echo_ref_ring echo_ref;
+    struct audio_trace trace;
 };
 
 struct stream_out {
@@ -128,6 +222,7 @@ struct stream_out {
     struct pcm *pcm;
     struct pcm_config *pcm_config;
     bool standby;
+    uint32_t sample_rate; /* rate reported to the framework */
     uint64_t written; /* total frames written, not cleared when entering standby */
 
     struct resampler_itfe *resampler;
@@ -138,6 +233,9 @@ struct stream_out {
     int cur_write_threshold;
     int buffer_type;
 
+    uint64_t resample_ns;       /* thread CPU time spent in the resampler */
+    uint64_t resample_frames;   /* stream frames that went through it */
+
     struct audio_device *dev;
 };
 
@@ -158,6 +256,12 @@ struct stream_in {
     size_t frames_in;
     int read_status;
 
+    effect_handle_t aec;                    /* AEC fed from the echo reference */
+    struct resampler_itfe *echo_ref_resampler;
+    uint32_t echo_ref_rate;                 /* input rate of echo_ref_resampler */
+    int16_t *echo_ref_buffer;
+    size_t echo_ref_buffer_frames;
+
     struct audio_device *dev;
 };
 
@@ -187,6 +291,137 @@ static void release_buffer(struct resampler_buffer_provider *buffer_provider,
 
 /* Helper functions */
 
+/* must be called with hw device mutex locked */
+static struct pcm_config *get_sco_config(struct audio_device *adev)
+{
+    return adev->bt_wb_sco_on ? &pcm_config_sco_wb : &pcm_config_sco;
+}
+
+/*
+ * SCO and fast capture streams are converted with the short filter
+ * resampler: its group delay is a fraction of the default one and it is
+ * cheap enough to run on every short period, in both directions. With
+ * 48 kHz playback the wideband SCO ratio is exactly 3.
+ */
+static int get_resampler_quality(const struct pcm_config *pcm_config)
+{
+    if (pcm_config == &pcm_config_sco || pcm_config == &pcm_config_sco_wb ||
+            pcm_config == &pcm_config_in_low_latency ||
+            pcm_config == &pcm_config_in_low_latency_48000)
+        return RESAMPLER_QUALITY_VOIP;
+
+    return RESAMPLER_QUALITY_DEFAULT;
+}
+
+/* group 2 counterpart of a main mic configuration */
+static struct pcm_config *get_in_config_48000(const struct pcm_config *pcm_config)
+{
+    return pcm_config == &pcm_config_in_low_latency ?
+            &pcm_config_in_low_latency_48000 : &pcm_config_in_48000;
+}
+
+static int64_t thread_cpu_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t audio_trace_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void audio_trace_open(struct audio_trace *trace)
+{
+    pthread_mutex_init(&trace->lock, NULL);
+    if (!property_get_bool(AUDIO_TRACE_PROPERTY, false))
+        return;
+
+    trace->file = fopen(AUDIO_TRACE_FILE, "w");
+    if (!trace->file) {
+        ALOGE("cannot open %s: %s", AUDIO_TRACE_FILE, strerror(errno));
+        return;
+    }
+    trace->start_ns = audio_trace_now_ns();
+    fprintf(trace->file, "# audio.primary.grouper trace v1 out_period %d in_period %d\n",
+            OUT_PERIOD_SIZE, IN_PERIOD_SIZE);
+}
+
+static void audio_trace_close(struct audio_trace *trace)
+{
+    if (trace->file)
+        fclose(trace->file);
+    pthread_mutex_destroy(&trace->lock);
+}
+
+static void audio_trace(struct audio_device *adev, const char *fmt, ...)
+{
+    struct audio_trace *trace = &adev->trace;
+    va_list args;
+
+    if (!trace->file)
+        return;
+
+    pthread_mutex_lock(&trace->lock);
+    fprintf(trace->file, "%lld ",
+            (long long)((audio_trace_now_ns() - trace->start_ns) / 1000));
+    va_start(args, fmt);
+    vfprintf(trace->file, fmt, args);
+    va_end(args);
+    fputc('\n', trace->file);
+    if (++trace->records >= AUDIO_TRACE_FLUSH_RECORDS) {
+        fflush(trace->file);
+        trace->records = 0;
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+
+static void audio_trace_flush(struct audio_device *adev)
+{
+    struct audio_trace *trace = &adev->trace;
+
+    if (!trace->file)
+        return;
+
+    pthread_mutex_lock(&trace->lock);
+    fflush(trace->file);
+    trace->records = 0;
+    pthread_mutex_unlock(&trace->lock);
+}
+
+/*
+ * Capture rates for which a fast input gets the low latency PCM
+ * configuration. Rates other than the PCM rate are converted with a
+ * short filter resampler.
+ */
+static bool is_low_latency_input_rate(uint32_t sample_rate)
+{
+    return sample_rate == IN_SAMPLING_RATE ||
+           sample_rate == 48000 ||
+           sample_rate == 16000;
+}
+
+/*
+ * take resampling into account and return the closest majoring
+ * multiple of 16 frames, as audioflinger expects audio buffers to
+ * be a multiple of 16 frames
+ */
+static size_t get_input_buffer_frames(const struct pcm_config *pcm_config,
+                                      uint32_t sample_rate)
+{
+    size_t size;
+
+    size = (pcm_config->period_size * sample_rate) / pcm_config->rate;
+    size = ((size + 15) / 16) * 16;
+
+    return size;
+}
+
 static void select_devices(struct audio_device *adev)
 {
     int headphone_on;
@@ -259,6 +494,10 @@ static void do_in_standby(struct stream_in *in)
             free(in->buffer);
             in->buffer = NULL;
         }
+        if (in->echo_ref_resampler) {
+            release_resampler(in->echo_ref_resampler);
+            in->echo_ref_resampler = NULL;
+        }
         in->standby = true;
     }
 }
@@ -278,20 +517,30 @@ static int start_output_stream(struct stream_out *out)
      */
     if (adev->out_device & AUDIO_DEVICE_OUT_ALL_SCO) {
         device = PCM_DEVICE_SCO;
-        out->pcm_config = &pcm_config_sco;
+        out->pcm_config = get_sco_config(adev);
     } else {
         device = PCM_DEVICE;
         out->pcm_config = &pcm_config_out;
-        out->buffer_type = OUT_BUFFER_TYPE_UNKNOWN;
     }
+    out->buffer_type = OUT_BUFFER_TYPE_UNKNOWN;
 
     /*
      * All open PCMs can only use a single group of rates at once:
      * Group 1: 11.025, 22.05, 44.1
      * Group 2: 8, 16, 32, 48
-     * Group 1 is used for digital audio playback since 44.1 is
-     * the most common rate, but group 2 is required for SCO.
+     * The PCM runs at the stream rate unless a capture is already
+     * running, in which case it joins the group of the capture and
+     * resamples until the next standby. Neither direction ever stops
+     * the other one to change group, except for SCO.
      */
+    if (device == PCM_DEVICE) {
+        if (adev->active_in)
+            out->pcm_config = (adev->active_in->pcm_config->rate % 11025 == 0) ?
+                    &pcm_config_out : &pcm_config_out_48000;
+        else if (out->sample_rate == OUT_SAMPLING_RATE_48000)
+            out->pcm_config = &pcm_config_out_48000;
+    }
+
     if (adev->active_in) {
         struct stream_in *in = adev->active_in;
         pthread_mutex_lock(&in->lock);
@@ -319,7 +568,7 @@ static int start_output_stream(struct stream_out *out)
         ret = create_resampler(out_get_sample_rate(&out->stream.common),
                                out->pcm_config->rate,
                                out->pcm_config->channels,
-                               RESAMPLER_QUALITY_DEFAULT,
+                               get_resampler_quality(out->pcm_config),
                                NULL,
                                &out->resampler);
         out->buffer_frames = (pcm_config_out.period_size * out->pcm_config->rate) /
@@ -347,7 +596,7 @@ static int start_input_stream(struct stream_in *in)
      */
     if (adev->in_device & AUDIO_DEVICE_IN_ALL_SCO) {
         device = PCM_DEVICE_SCO;
-        in->pcm_config = &pcm_config_sco;
+        in->pcm_config = get_sco_config(adev);
     } else {
         device = PCM_DEVICE;
         in->pcm_config = in->pcm_config_non_sco;
@@ -357,9 +606,21 @@ static int start_input_stream(struct stream_in *in)
      * All open PCMs can only use a single group of rates at once:
      * Group 1: 11.025, 22.05, 44.1
      * Group 2: 8, 16, 32, 48
-     * Group 1 is used for digital audio playback since 44.1 is
-     * the most common rate, but group 2 is required for SCO.
+     * The mic is captured in the group of a running output and
+     * resampled, so starting a capture never interrupts playback.
+     * Without an output it is captured in the group of the stream
+     * rate, which a later output then joins.
+     * Only SCO, which requires group 2, stops a 44.1 kHz output.
      */
+    if (device == PCM_DEVICE) {
+        if (adev->active_out) {
+            if (adev->active_out->pcm_config->rate % 8000 == 0)
+                in->pcm_config = get_in_config_48000(in->pcm_config_non_sco);
+        } else if (in->requested_rate % 8000 == 0) {
+            in->pcm_config = get_in_config_48000(in->pcm_config_non_sco);
+        }
+    }
+
     if (adev->active_out) {
         struct stream_out *out = adev->active_out;
         pthread_mutex_lock(&out->lock);
@@ -390,7 +651,7 @@ static int start_input_stream(struct stream_in *in)
         ret = create_resampler(in->pcm_config->rate,
                                in_get_sample_rate(&in->stream.common),
                                1,
-                               RESAMPLER_QUALITY_DEFAULT,
+                               get_resampler_quality(in->pcm_config),
                                &in->buf_provider,
                                &in->resampler);
     }
@@ -502,11 +763,182 @@ static ssize_t read_frames(struct stream_in *in, void *buffer, ssize_t frames)
     return frames_wr;
 }
 
+/* Echo reference */
+
+static int64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/* must be called with the output stream mutex locked, right before pcm_write() */
+static void echo_ref_publish(struct stream_out *out, const int16_t *frames,
+                             size_t count)
+{
+    struct echo_ref_ring *ring = &out->dev->echo_ref;
+    unsigned int channels = out->pcm_config->channels;
+    unsigned int rate = out->pcm_config->rate;
+    unsigned int avail;
+    unsigned int pos;
+    struct timespec ts;
+    int64_t play_ns;
+    size_t i;
+
+    if (atomic_load_explicit(&ring->readers, memory_order_relaxed) == 0)
+        return;
+
+    /*
+     * The first frame of this buffer is played once everything
+     * already queued in the kernel has been consumed.
+     */
+    if (pcm_get_htimestamp(out->pcm, &avail, &ts) < 0)
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    else
+        avail = pcm_get_buffer_size(out->pcm) - avail;
+    play_ns = timespec_to_ns(&ts) + ((int64_t)avail * 1000000000LL) / rate;
+
+    pos = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    for (i = 0; i < count; i++) {
+        int16_t sample = frames[i * channels];
+
+        if (channels == 2)
+            sample = (int16_t)(((int32_t)sample + frames[i * 2 + 1]) / 2);
+        ring->buffer[(pos + i) & (ECHO_REF_FRAMES - 1)] = sample;
+    }
+
+    atomic_fetch_add_explicit(&ring->seq, 1, memory_order_acq_rel);
+    atomic_store_explicit(&ring->anchor_pos, pos, memory_order_relaxed);
+    atomic_store_explicit(&ring->anchor_ns, play_ns, memory_order_relaxed);
+    atomic_store_explicit(&ring->rate, rate, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ring->seq, 1, memory_order_release);
+
+    atomic_store_explicit(&ring->write_pos, pos + count, memory_order_release);
+}
+
+/*
+ * Copies the count reference frames that were played at capture_ns.
+ * Frames that were not played yet or have already been overwritten
+ * are returned as silence. Returns the ring rate, or 0 if nothing was
+ * ever published.
+ */
+static unsigned int echo_ref_read(struct echo_ref_ring *ring, int64_t capture_ns,
+                                  int16_t *dst, size_t count)
+{
+    unsigned int seq, anchor_pos, rate, write_pos, pos;
+    int64_t anchor_ns;
+    size_t i;
+
+    do {
+        seq = atomic_load_explicit(&ring->seq, memory_order_acquire);
+        anchor_pos = atomic_load_explicit(&ring->anchor_pos, memory_order_relaxed);
+        anchor_ns = atomic_load_explicit(&ring->anchor_ns, memory_order_relaxed);
+        rate = atomic_load_explicit(&ring->rate, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&ring->seq, memory_order_relaxed));
+
+    if (rate == 0)
+        return 0;
+
+    pos = anchor_pos + (int32_t)(((capture_ns - anchor_ns) * rate) / 1000000000LL);
+    write_pos = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+
+    for (i = 0; i < count; i++) {
+        int32_t age = (int32_t)(write_pos - (pos + i));
+
+        dst[i] = (age > 0 && age <= ECHO_REF_FRAMES) ?
+                ring->buffer[(pos + i) & (ECHO_REF_FRAMES - 1)] : 0;
+    }
+
+    /* discard whatever the writer may have overwritten while copying */
+    write_pos = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+    for (i = 0; i < count; i++) {
+        if ((int32_t)(write_pos - (pos + i)) > ECHO_REF_FRAMES)
+            dst[i] = 0;
+    }
+
+    return rate;
+}
+
+/*
+ * Feeds the reference played while the frames just read were captured
+ * to the AEC, then runs the AEC on the capture in place.
+ * must be called with the input stream mutex locked
+ */
+static void in_process_echo_reference(struct stream_in *in, int16_t *buffer,
+                                      size_t frames)
+{
+    struct echo_ref_ring *ring = &in->dev->echo_ref;
+    unsigned int in_rate = in_get_sample_rate(&in->stream.common);
+    unsigned int avail, ring_rate;
+    size_t ref_frames, out_frames;
+    struct timespec ts;
+    int64_t capture_ns;
+    audio_buffer_t ref_buf;
+    audio_buffer_t buf;
+
+    if (pcm_get_htimestamp(in->pcm, &avail, &ts) < 0)
+        return;
+
+    /* frames still buffered in the kernel and in the HAL were captured after these */
+    capture_ns = timespec_to_ns(&ts) -
+            ((int64_t)(avail + in->frames_in) * 1000000000LL) / in->pcm_config->rate -
+            ((int64_t)frames * 1000000000LL) / in_rate;
+
+    ring_rate = atomic_load_explicit(&ring->rate, memory_order_relaxed);
+    if (ring_rate == 0)
+        ring_rate = in_rate;
+    ref_frames = (frames * ring_rate) / in_rate + 1;
+    if (ref_frames + frames > in->echo_ref_buffer_frames) {
+        int16_t *b = realloc(in->echo_ref_buffer,
+                             (ref_frames + frames) * sizeof(int16_t));
+        if (b == NULL)
+            return;
+        in->echo_ref_buffer = b;
+        in->echo_ref_buffer_frames = ref_frames + frames;
+    }
+
+    ring_rate = echo_ref_read(ring, capture_ns, in->echo_ref_buffer, ref_frames);
+    if (ring_rate == 0)
+        memset(in->echo_ref_buffer, 0, ref_frames * sizeof(int16_t));
+
+    ref_buf.s16 = in->echo_ref_buffer;
+    if (ring_rate != 0 && ring_rate != in_rate) {
+        if (in->echo_ref_resampler && in->echo_ref_rate != ring_rate) {
+            release_resampler(in->echo_ref_resampler);
+            in->echo_ref_resampler = NULL;
+        }
+        if (!in->echo_ref_resampler) {
+            if (create_resampler(ring_rate, in_rate, 1, RESAMPLER_QUALITY_VOIP,
+                                 NULL, &in->echo_ref_resampler) != 0)
+                return;
+            in->echo_ref_rate = ring_rate;
+        }
+        int16_t *resampled = in->echo_ref_buffer + ref_frames;
+
+        out_frames = frames;
+        in->echo_ref_resampler->resample_from_input(in->echo_ref_resampler,
+                in->echo_ref_buffer, &ref_frames,
+                resampled, &out_frames);
+        if (out_frames < frames)
+            memset(resampled + out_frames, 0,
+                   (frames - out_frames) * sizeof(int16_t));
+        ref_buf.s16 = resampled;
+    }
+    ref_buf.frameCount = frames;
+
+    (*in->aec)->process_reverse(in->aec, &ref_buf, NULL);
+
+    buf.s16 = buffer;
+    buf.frameCount = frames;
+    (*in->aec)->process(in->aec, &buf, &buf);
+}
+
 /* API functions */
 
 static uint32_t out_get_sample_rate(const struct audio_stream *stream)
 {
-    return pcm_config_out.rate;
+    struct stream_out *out = (struct stream_out *)stream;
+
+    return out->sample_rate;
 }
 
 static int out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
@@ -539,6 +971,9 @@ static int out_standby(struct audio_stream *stream)
 {
     struct stream_out *out = (struct stream_out *)stream;
 
+    audio_trace(out->dev, "SO");
+    audio_trace_flush(out->dev);
+
     pthread_mutex_lock(&out->dev->lock);
     pthread_mutex_lock(&out->lock);
     do_out_standby(out);
@@ -550,6 +985,21 @@ static int out_standby(struct audio_stream *stream)
 
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+    struct stream_out *out = (struct stream_out *)stream;
+
+    pthread_mutex_lock(&out->lock);
+    dprintf(fd, "      Stream rate: %u, PCM rate: %u, resampling: %s\n",
+            out->sample_rate,
+            out->standby ? 0 : out->pcm_config->rate,
+            out->resampler ? "yes" : "no");
+    /* CPU cost of the HAL resampler, per second of audio it converted */
+    if (out->resample_frames)
+        dprintf(fd, "      Resampler CPU: %llu us/s over %llu ms of audio\n",
+                (unsigned long long)(out->resample_ns * out->sample_rate /
+                                     out->resample_frames / 1000),
+                (unsigned long long)(out->resample_frames * 1000 / out->sample_rate));
+    pthread_mutex_unlock(&out->lock);
+
     return 0;
 }
 
@@ -562,6 +1012,8 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     int ret;
     unsigned int val;
 
+    audio_trace(adev, "PO %s", kvpairs);
+
     parms = str_parms_create_str(kvpairs);
 
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING,
@@ -611,7 +1063,7 @@ static uint32_t out_get_latency(const struct audio_stream_out *stream)
 
     pthread_mutex_unlock(&adev->lock);
 
-    return (pcm_config_out.period_size * period_count * 1000) / pcm_config_out.rate;
+    return (pcm_config_out.period_size * period_count * 1000) / out->sample_rate;
 }
 
 static int out_set_volume(struct audio_stream_out *stream, float left,
@@ -629,9 +1081,13 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
     size_t frame_size = audio_stream_out_frame_size(stream);
     int16_t *in_buffer = (int16_t *)buffer;
     size_t in_frames = bytes / frame_size;
+    size_t stream_frames = in_frames;
     size_t out_frames;
+    size_t period_size;
     int buffer_type;
-    int kernel_frames;
+    int kernel_frames = -1;
+    int total_sleep_time_us = 0;
+    int64_t start_ns = adev->trace.file ? audio_trace_now_ns() : 0;
     bool sco_on;
 
     /*
@@ -650,14 +1106,15 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
         }
         out->standby = false;
     }
-    buffer_type = (adev->screen_off && !adev->active_in) ?
-            OUT_BUFFER_TYPE_LONG : OUT_BUFFER_TYPE_SHORT;
+    /* SCO is paced like the main PCM but never uses the long buffer */
     sco_on = (adev->out_device & AUDIO_DEVICE_OUT_ALL_SCO);
+    buffer_type = (adev->screen_off && !adev->active_in && !sco_on) ?
+            OUT_BUFFER_TYPE_LONG : OUT_BUFFER_TYPE_SHORT;
     pthread_mutex_unlock(&adev->lock);
 
     /* detect changes in screen ON/OFF state and adapt buffer size
-     * if needed. Do not change buffer size when routed to SCO device. */
-    if (!sco_on && (buffer_type != out->buffer_type)) {
+     * if needed. */
+    if (buffer_type != out->buffer_type) {
         size_t period_count;
 
         if (buffer_type == OUT_BUFFER_TYPE_LONG)
@@ -687,81 +1144,87 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
 
     /* Change sample rate, if necessary */
     if (out_get_sample_rate(&stream->common) != out->pcm_config->rate) {
+        int64_t cpu_ns = thread_cpu_time_ns();
+
         out_frames = out->buffer_frames;
         out->resampler->resample_from_input(out->resampler,
                                             in_buffer, &in_frames,
                                             out->buffer, &out_frames);
         in_buffer = out->buffer;
+        out->resample_ns += thread_cpu_time_ns() - cpu_ns;
+        out->resample_frames += in_frames;
     } else {
         out_frames = in_frames;
     }
 
-    if (!sco_on) {
-        int total_sleep_time_us = 0;
-        size_t period_size = out->pcm_config->period_size;
-
-        /* do not allow more than out->cur_write_threshold frames in kernel
-         * pcm driver buffer */
-        do {
-            struct timespec time_stamp;
-            if (pcm_get_htimestamp(out->pcm,
-                                   (unsigned int *)&kernel_frames,
-                                   &time_stamp) < 0)
+    period_size = out->pcm_config->period_size;
+
+    /* do not allow more than out->cur_write_threshold frames in kernel
+     * pcm driver buffer */
+    do {
+        struct timespec time_stamp;
+        if (pcm_get_htimestamp(out->pcm,
+                               (unsigned int *)&kernel_frames,
+                               &time_stamp) < 0)
+            break;
+        kernel_frames = pcm_get_buffer_size(out->pcm) - kernel_frames;
+
+        if (kernel_frames > out->cur_write_threshold) {
+            int sleep_time_us =
+                (int)(((int64_t)(kernel_frames - out->cur_write_threshold)
+                                * 1000000) / out->pcm_config->rate);
+            if (sleep_time_us < MIN_WRITE_SLEEP_US)
                 break;
-            kernel_frames = pcm_get_buffer_size(out->pcm) - kernel_frames;
-
-            if (kernel_frames > out->cur_write_threshold) {
-                int sleep_time_us =
-                    (int)(((int64_t)(kernel_frames - out->cur_write_threshold)
-                                    * 1000000) / out->pcm_config->rate);
-                if (sleep_time_us < MIN_WRITE_SLEEP_US)
-                    break;
-                total_sleep_time_us += sleep_time_us;
-                if (total_sleep_time_us > MAX_WRITE_SLEEP_US) {
-                    ALOGW("out_write() limiting sleep time %d to %d",
-                          total_sleep_time_us, MAX_WRITE_SLEEP_US);
-                    sleep_time_us = MAX_WRITE_SLEEP_US -
-                                        (total_sleep_time_us - sleep_time_us);
-                }
-                usleep(sleep_time_us);
+            total_sleep_time_us += sleep_time_us;
+            if (total_sleep_time_us > MAX_WRITE_SLEEP_US) {
+                ALOGW("out_write() limiting sleep time %d to %d",
+                      total_sleep_time_us, MAX_WRITE_SLEEP_US);
+                sleep_time_us = MAX_WRITE_SLEEP_US -
+                                    (total_sleep_time_us - sleep_time_us);
             }
+            usleep(sleep_time_us);
+        }
 
-        } while ((kernel_frames > out->cur_write_threshold) &&
-                (total_sleep_time_us <= MAX_WRITE_SLEEP_US));
+    } while ((kernel_frames > out->cur_write_threshold) &&
+            (total_sleep_time_us <= MAX_WRITE_SLEEP_US));
 
-        /* do not allow abrupt changes on buffer size. Increasing/decreasing
-         * the threshold by steps of 1/4th of the buffer size keeps the write
-         * time within a reasonable range during transitions.
-         * Also reset current threshold just above current filling status when
-         * kernel buffer is really depleted to allow for smooth catching up with
-         * target threshold.
-         */
+    /* do not allow abrupt changes on buffer size. Increasing/decreasing
+     * the threshold by steps of 1/4th of the buffer size keeps the write
+     * time within a reasonable range during transitions.
+     * Also reset current threshold just above current filling status when
+     * kernel buffer is really depleted to allow for smooth catching up with
+     * target threshold.
+     */
+    if (out->cur_write_threshold > out->write_threshold) {
+        out->cur_write_threshold -= period_size / 4;
+        if (out->cur_write_threshold < out->write_threshold) {
+            out->cur_write_threshold = out->write_threshold;
+        }
+    } else if (out->cur_write_threshold < out->write_threshold) {
+        out->cur_write_threshold += period_size / 4;
         if (out->cur_write_threshold > out->write_threshold) {
-            out->cur_write_threshold -= period_size / 4;
-            if (out->cur_write_threshold < out->write_threshold) {
-                out->cur_write_threshold = out->write_threshold;
-            }
-        } else if (out->cur_write_threshold < out->write_threshold) {
-            out->cur_write_threshold += period_size / 4;
-            if (out->cur_write_threshold > out->write_threshold) {
-                out->cur_write_threshold = out->write_threshold;
-            }
-        } else if ((kernel_frames < out->write_threshold) &&
-            ((out->write_threshold - kernel_frames) >
-                (int)(period_size * OUT_SHORT_PERIOD_COUNT))) {
-            out->cur_write_threshold = (kernel_frames / period_size + 1) * period_size;
-            out->cur_write_threshold += period_size / 4;
+            out->cur_write_threshold = out->write_threshold;
         }
+    } else if ((kernel_frames < out->write_threshold) &&
+        ((out->write_threshold - kernel_frames) >
+            (int)(period_size * OUT_SHORT_PERIOD_COUNT))) {
+        out->cur_write_threshold = (kernel_frames / period_size + 1) * period_size;
+        out->cur_write_threshold += period_size / 4;
     }
 
+    echo_ref_publish(out, in_buffer, out_frames);
+
     ret = pcm_write(out->pcm, in_buffer, out_frames * frame_size);
+    audio_trace(adev, "W %zu %d %d %d %lld %d", bytes, kernel_frames,
+                out->cur_write_threshold, total_sleep_time_us,
+                (long long)((audio_trace_now_ns() - start_ns) / 1000), ret);
     if (ret == -EPIPE) {
         /* In case of underrun, don't sleep since we want to catch up asap */
         pthread_mutex_unlock(&out->lock);
         return ret;
     }
     if (ret == 0) {
-        out->written += out_frames;
+        out->written += stream_frames;
     }
 
 exit:
@@ -808,8 +1271,11 @@ static int out_get_presentation_position(const struct audio_stream_out *stream,
     size_t avail;
     if (pcm_get_htimestamp(out->pcm, &avail, timestamp) == 0) {
         size_t kernel_buffer_size = out->pcm_config->period_size * out->pcm_config->period_count;
+        // written is counted at the stream rate, the kernel queue at the PCM rate
+        int64_t kernel_frames = ((int64_t)(kernel_buffer_size - avail) * out->sample_rate) /
+                out->pcm_config->rate;
         // FIXME This calculation is incorrect if there is buffering after app processor
-        int64_t signed_frames = out->written - kernel_buffer_size + avail;
+        int64_t signed_frames = out->written - kernel_frames;
         // It would be unusual for this value to be negative, but check just in case ...
         if (signed_frames >= 0) {
             *frames = signed_frames;
@@ -838,18 +1304,9 @@ static int in_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 static size_t in_get_buffer_size(const struct audio_stream *stream)
 {
     struct stream_in *in = (struct stream_in *)stream;
-    size_t size;
-
-    /*
-     * take resampling into account and return the closest majoring
-     * multiple of 16 frames, as audioflinger expects audio buffers to
-     * be a multiple of 16 frames
-     */
-    size = (in->pcm_config->period_size * in_get_sample_rate(stream)) /
-            in->pcm_config->rate;
-    size = ((size + 15) / 16) * 16;
 
-    return size * audio_stream_in_frame_size(&in->stream);
+    return get_input_buffer_frames(in->pcm_config, in_get_sample_rate(stream)) *
+               audio_stream_in_frame_size(&in->stream);
 }
 
 static uint32_t in_get_channels(const struct audio_stream *stream)
@@ -871,6 +1328,9 @@ static int in_standby(struct audio_stream *stream)
 {
     struct stream_in *in = (struct stream_in *)stream;
 
+    audio_trace(in->dev, "SI");
+    audio_trace_flush(in->dev);
+
     pthread_mutex_lock(&in->dev->lock);
     pthread_mutex_lock(&in->lock);
     do_in_standby(in);
@@ -894,6 +1354,8 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
     int ret;
     unsigned int val;
 
+    audio_trace(adev, "PI %s", kvpairs);
+
     parms = str_parms_create_str(kvpairs);
 
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING,
@@ -972,6 +1434,21 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
         unsigned int i;
         int16_t *in_buffer = (int16_t *)buffer;
 
+        /*
+         * The client buffer is sized for the PCM configuration of the
+         * open, a capture joining a 48 kHz output runs another one.
+         */
+        if (bytes * 2 > in->buffer_size) {
+            int16_t *b = realloc(in->buffer, bytes * 2);
+
+            if (b == NULL) {
+                ret = -ENOMEM;
+                goto exit;
+            }
+            in->buffer = b;
+            in->buffer_size = bytes * 2;
+        }
+
         ret = pcm_read(in->pcm, in->buffer, bytes * 2);
 
         /* Discard right channel */
@@ -984,6 +1461,11 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
     if (ret > 0)
         ret = 0;
 
+    if (ret == 0 && in->aec)
+        in_process_echo_reference(in, (int16_t *)buffer, frames_rq);
+
+    audio_trace(adev, "R %zu %d", bytes, ret);
+
     /*
      * Instead of writing zeroes here, we could trust the hardware
      * to always provide zeroes when muted.
@@ -1005,15 +1487,75 @@ static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
     return 0;
 }
 
+/*
+ * The echo reference is handed to process_reverse() mono at the capture
+ * rate, which is not the format the framework configured the AEC with.
+ * must be called with the input stream mutex locked
+ */
+static int in_configure_reverse(struct stream_in *in, effect_handle_t effect)
+{
+    effect_config_t config;
+    uint32_t size = sizeof(int32_t);
+    int32_t status = 0;
+    int ret;
+
+    memset(&config, 0, sizeof(config));
+    config.inputCfg.samplingRate = in_get_sample_rate(&in->stream.common);
+    config.inputCfg.channels = AUDIO_CHANNEL_IN_MONO;
+    config.inputCfg.format = AUDIO_FORMAT_PCM_16_BIT;
+    config.inputCfg.mask = (EFFECT_CONFIG_SMP_RATE | EFFECT_CONFIG_CHANNELS |
+                            EFFECT_CONFIG_FORMAT);
+    config.outputCfg = config.inputCfg;
+
+    ret = (*effect)->command(effect, EFFECT_CMD_SET_CONFIG_REVERSE,
+                             sizeof(effect_config_t), &config, &size, &status);
+    if (ret == 0)
+        ret = status;
+    if (ret != 0)
+        ALOGE("in_configure_reverse(): EFFECT_CMD_SET_CONFIG_REVERSE failed %d", ret);
+
+    return ret;
+}
+
 static int in_add_audio_effect(const struct audio_stream *stream,
                                effect_handle_t effect)
 {
-    return 0;
+    struct stream_in *in = (struct stream_in *)stream;
+    effect_descriptor_t desc;
+    int ret = 0;
+
+    if ((*effect)->get_descriptor(effect, &desc) != 0)
+        return -EINVAL;
+
+    /* only the AEC needs the HAL: it is fed from the echo reference */
+    if (memcmp(&desc.type, FX_IID_AEC, sizeof(effect_uuid_t)) != 0)
+        return 0;
+
+    pthread_mutex_lock(&in->lock);
+    if (!in->aec) {
+        ret = in_configure_reverse(in, effect);
+        if (ret == 0) {
+            in->aec = effect;
+            atomic_fetch_add(&in->dev->echo_ref.readers, 1);
+        }
+    }
+    pthread_mutex_unlock(&in->lock);
+
+    return ret;
 }
 
 static int in_remove_audio_effect(const struct audio_stream *stream,
                                   effect_handle_t effect)
 {
+    struct stream_in *in = (struct stream_in *)stream;
+
+    pthread_mutex_lock(&in->lock);
+    if (in->aec == effect) {
+        in->aec = NULL;
+        atomic_fetch_sub(&in->dev->echo_ref.readers, 1);
+    }
+    pthread_mutex_unlock(&in->lock);
+
     return 0;
 }
 
@@ -1055,10 +1597,19 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
 
     out->dev = adev;
 
+    /*
+     * The policy offers 44.1 and 48 kHz: the PCM follows the rate the output
+     * is opened at, anything else runs at 48 kHz.
+     */
+    out->sample_rate = (config->sample_rate == OUT_SAMPLING_RATE) ?
+            OUT_SAMPLING_RATE : OUT_SAMPLING_RATE_48000;
+
     config->format = out_get_format(&out->stream.common);
     config->channel_mask = out_get_channels(&out->stream.common);
     config->sample_rate = out_get_sample_rate(&out->stream.common);
 
+    audio_trace(adev, "OO %u %#x", out->sample_rate, flags);
+
     out->standby = true;
     /* out->written = 0; by calloc() */
 
@@ -1086,6 +1637,8 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
     char value[32];
     int ret;
 
+    audio_trace(adev, "PD %s", kvpairs);
+
     parms = str_parms_create_str(kvpairs);
     ret = str_parms_get_str(parms, "orientation", value, sizeof(value));
     if (ret >= 0) {
@@ -1123,6 +1676,28 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
             adev->screen_off = true;
     }
 
+    ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_BT_SCO_WB, value, sizeof(value));
+    if (ret >= 0) {
+        bool wb = (strcmp(value, AUDIO_PARAMETER_VALUE_ON) == 0);
+
+        pthread_mutex_lock(&adev->lock);
+        if (wb != adev->bt_wb_sco_on) {
+            adev->bt_wb_sco_on = wb;
+            /* restart a running SCO link at the new rate */
+            if (adev->active_out && (adev->out_device & AUDIO_DEVICE_OUT_ALL_SCO)) {
+                pthread_mutex_lock(&adev->active_out->lock);
+                do_out_standby(adev->active_out);
+                pthread_mutex_unlock(&adev->active_out->lock);
+            }
+            if (adev->active_in && (adev->in_device & AUDIO_DEVICE_IN_ALL_SCO)) {
+                pthread_mutex_lock(&adev->active_in->lock);
+                do_in_standby(adev->active_in);
+                pthread_mutex_unlock(&adev->active_in->lock);
+            }
+        }
+        pthread_mutex_unlock(&adev->lock);
+    }
+
     str_parms_destroy(parms);
     return ret;
 }
@@ -1177,12 +1752,11 @@ static size_t adev_get_input_buffer_size(const struct audio_hw_device *dev,
     size_t size;
 
     /*
-     * take resampling into account and return the closest majoring
-     * multiple of 16 frames, as audioflinger expects audio buffers to
-     * be a multiple of 16 frames
+     * The input flags are not known here, so this is the normal capture
+     * period. A fast input reports its own low latency period through
+     * in_get_buffer_size() once it is opened.
      */
-    size = (pcm_config_in.period_size * config->sample_rate) / pcm_config_in.rate;
-    size = ((size + 15) / 16) * 16;
+    size = get_input_buffer_frames(&pcm_config_in, config->sample_rate);
 
     return (size * audio_channel_count_from_in_mask(config->channel_mask) *
                 audio_bytes_per_sample(config->format));
@@ -1233,10 +1807,13 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     in->standby = true;
     in->requested_rate = config->sample_rate;
     /* default PCM config */
-    in->pcm_config = (config->sample_rate == IN_SAMPLING_RATE) && (flags & AUDIO_INPUT_FLAG_FAST) ?
+    in->pcm_config = is_low_latency_input_rate(config->sample_rate) &&
+                     (flags & AUDIO_INPUT_FLAG_FAST) ?
             &pcm_config_in_low_latency : &pcm_config_in;
     in->pcm_config_non_sco = in->pcm_config;
 
+    audio_trace(adev, "OI %u %#x", in->requested_rate, flags);
+
     *stream_in = &in->stream;
     return 0;
 }
@@ -1247,6 +1824,9 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
     struct stream_in *in = (struct stream_in *)stream;
 
     in_standby(&stream->common);
+    if (in->aec)
+        atomic_fetch_sub(&in->dev->echo_ref.readers, 1);
+    free(in->echo_ref_buffer);
     free(stream);
 }
 
@@ -1260,6 +1840,7 @@ static int adev_close(hw_device_t *device)
     struct audio_device *adev = (struct audio_device *)device;
 
     audio_route_free(adev->ar);
+    audio_trace_close(&adev->trace);
 
     free(device);
     return 0;
@@ -1302,6 +1883,7 @@ static int adev_open(const hw_module_t* module, const char* name,
     adev->orientation = ORIENTATION_UNDEFINED;
     adev->out_device = AUDIO_DEVICE_OUT_SPEAKER;
     adev->in_device = AUDIO_DEVICE_IN_BUILTIN_MIC & ~AUDIO_DEVICE_BIT_IN;
+    audio_trace_open(&adev->trace);
 
     *device = &adev->hw_device.common;
 
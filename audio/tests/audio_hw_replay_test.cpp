@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays the HAL call traces written with audio.grouper.trace against
+ * the HAL linked to the simulated PCM of sim_pcm.c, and checks the
+ * budgets a trace declares in its header:
+ *   # budget <name> <value> ...
+ * underruns and overruns of the PCMs, pcm_opens (a stream that is
+ * restarted under the other one glitches), max_latency_ms of the output
+ * kernel queue, sleeps_per_s, the out_write() wakeups per second, and
+ * out_rate and in_rate, the rates the last PCMs were opened at.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <hardware/audio.h>
+#include <hardware/hardware.h>
+
+#include "sim_pcm.h"
+
+#ifndef AUDIO_TRACE_DIR
+#define AUDIO_TRACE_DIR "tests/traces"
+#endif
+
+extern "C" struct audio_module HAL_MODULE_INFO_SYM;
+
+namespace {
+
+struct ReplayResult {
+    struct sim_pcm_stats stats;
+    int64_t duration_ns;
+    unsigned int records;
+};
+
+class AudioTraceReplay : public ::testing::TestWithParam<const char *> {
+protected:
+    virtual void SetUp() {
+        const char *dir = getenv("AUDIO_TRACE_DIR");
+
+        mPath = std::string(dir ? dir : AUDIO_TRACE_DIR) + "/" + GetParam() + ".txt";
+        mDev = NULL;
+        mOut = NULL;
+        mIn = NULL;
+        sim_reset();
+        ASSERT_EQ(0, HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common,
+                AUDIO_HARDWARE_INTERFACE, (struct hw_device_t **)&mDev));
+    }
+
+    virtual void TearDown() {
+        if (mOut)
+            mDev->close_output_stream(mDev, mOut);
+        if (mIn)
+            mDev->close_input_stream(mDev, mIn);
+        if (mDev)
+            mDev->common.close(&mDev->common);
+    }
+
+    void replay(ReplayResult *result);
+    void replayRecord(char *op, char *args);
+
+    std::string mPath;
+    std::map<std::string, long> mBudgets;
+    struct audio_hw_device *mDev;
+    struct audio_stream_out *mOut;
+    struct audio_stream_in *mIn;
+    char mBuffer[65536];
+};
+
+void AudioTraceReplay::replayRecord(char *op, char *args)
+{
+    unsigned int rate, flags;
+    size_t bytes;
+
+    if (!strcmp(op, "OO") && sscanf(args, "%u %x", &rate, &flags) == 2) {
+        struct audio_config config;
+
+        ASSERT_TRUE(mOut == NULL);
+        config.sample_rate = rate;
+        config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+        config.format = AUDIO_FORMAT_PCM_16_BIT;
+        ASSERT_EQ(0, mDev->open_output_stream(mDev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                (audio_output_flags_t)flags, &config, &mOut, ""));
+    } else if (!strcmp(op, "OI") && sscanf(args, "%u %x", &rate, &flags) == 2) {
+        struct audio_config config;
+
+        ASSERT_TRUE(mIn == NULL);
+        config.sample_rate = rate;
+        config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+        config.format = AUDIO_FORMAT_PCM_16_BIT;
+        ASSERT_EQ(0, mDev->open_input_stream(mDev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                &config, &mIn, (audio_input_flags_t)flags, "", 0));
+    } else if (!strcmp(op, "W") && sscanf(args, "%zu", &bytes) == 1) {
+        ASSERT_TRUE(mOut != NULL);
+        ASSERT_LE(bytes, sizeof(mBuffer));
+        EXPECT_EQ((ssize_t)bytes, mOut->write(mOut, mBuffer, bytes));
+    } else if (!strcmp(op, "R") && sscanf(args, "%zu", &bytes) == 1) {
+        ASSERT_TRUE(mIn != NULL);
+        ASSERT_LE(bytes, sizeof(mBuffer));
+        EXPECT_EQ((ssize_t)bytes, mIn->read(mIn, mBuffer, bytes));
+    } else if (!strcmp(op, "PD")) {
+        mDev->set_parameters(mDev, args);
+    } else if (!strcmp(op, "PO")) {
+        ASSERT_TRUE(mOut != NULL);
+        mOut->common.set_parameters(&mOut->common, args);
+    } else if (!strcmp(op, "PI")) {
+        ASSERT_TRUE(mIn != NULL);
+        mIn->common.set_parameters(&mIn->common, args);
+    } else if (!strcmp(op, "SO")) {
+        ASSERT_TRUE(mOut != NULL);
+        mOut->common.standby(&mOut->common);
+    } else if (!strcmp(op, "SI")) {
+        ASSERT_TRUE(mIn != NULL);
+        mIn->common.standby(&mIn->common);
+    } else {
+        FAIL() << "unknown record " << op << " " << args;
+    }
+}
+
+void AudioTraceReplay::replay(ReplayResult *result)
+{
+    FILE *f = fopen(mPath.c_str(), "r");
+    int64_t start_ns = sim_now_ns();
+    char line[512];
+
+    ASSERT_TRUE(f != NULL) << mPath << ": " << strerror(errno);
+    memset(mBuffer, 0, sizeof(mBuffer));
+    result->records = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        char op[8];
+        long long us;
+        int args;
+
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '#') {
+            char *tok = strtok(line + 1, " ");
+
+            if (tok && !strcmp(tok, "budget")) {
+                char *name, *value;
+
+                while ((name = strtok(NULL, " ")) && (value = strtok(NULL, " ")))
+                    mBudgets[name] = strtol(value, NULL, 10);
+            }
+            continue;
+        }
+        args = strlen(line);
+        if (sscanf(line, "%lld %7s %n", &us, op, &args) < 2)
+            continue;
+
+        // The client called the HAL at that time, unless the HAL kept it longer
+        sim_advance_to(start_ns + us * 1000);
+        replayRecord(op, line + args);
+        if (::testing::Test::HasFatalFailure())
+            break;
+        result->records++;
+    }
+
+    fclose(f);
+    result->duration_ns = sim_now_ns() - start_ns;
+    sim_get_stats(&result->stats);
+}
+
+TEST_P(AudioTraceReplay, Budgets)
+{
+    ReplayResult result;
+
+    replay(&result);
+    if (HasFatalFailure())
+        return;
+    ASSERT_GT(result.records, 0u);
+
+    const struct sim_pcm_stats &s = result.stats;
+    double seconds = result.duration_ns / 1e9;
+
+    printf("%s: %u records over %.1f s, %u pcm opens, %u underruns, %u overruns, "
+           "%.1f sleeps/s, output queue max %u us avg %llu us\n",
+           GetParam(), result.records, seconds, s.pcm_opens, s.underruns, s.overruns,
+           s.sleeps / seconds, s.max_queued_us,
+           (unsigned long long)(s.writes ? s.queued_us_sum / s.writes : 0));
+
+    ASSERT_FALSE(mBudgets.empty()) << mPath << " declares no budget";
+    for (std::map<std::string, long>::const_iterator it = mBudgets.begin();
+            it != mBudgets.end(); ++it) {
+        if (it->first == "underruns")
+            EXPECT_LE(s.underruns, (unsigned long)it->second);
+        else if (it->first == "overruns")
+            EXPECT_LE(s.overruns, (unsigned long)it->second);
+        else if (it->first == "pcm_opens")
+            EXPECT_LE(s.pcm_opens, (unsigned long)it->second);
+        else if (it->first == "max_latency_ms")
+            EXPECT_LE(s.max_queued_us, (unsigned long)it->second * 1000);
+        else if (it->first == "sleeps_per_s")
+            EXPECT_LE(s.sleeps / seconds, (double)it->second);
+        else if (it->first == "out_rate")
+            EXPECT_EQ((unsigned long)it->second, s.out_rate);
+        else if (it->first == "in_rate")
+            EXPECT_EQ((unsigned long)it->second, s.in_rate);
+        else
+            ADD_FAILURE() << "unknown budget " << it->first;
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Corpus, AudioTraceReplay,
+        ::testing::Values("music", "game", "voip", "screen_off", "monitor"));
+
+} // namespace
@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tinyalsa/asoundlib.h>
+#include <audio_utils/resampler.h>
+#include <audio_route/audio_route.h>
+
+#include "sim_pcm.h"
+
+#define NS_PER_SEC 1000000000LL
+
+struct pcm {
+    struct pcm_config config;
+    unsigned int flags;
+    bool running;
+    int64_t start_ns;
+    uint64_t frames;    /* written (output) or read (input) since start */
+};
+
+static int64_t sim_ns;
+static struct sim_pcm_stats sim_stats;
+
+void sim_reset(void)
+{
+    sim_ns = NS_PER_SEC;
+    memset(&sim_stats, 0, sizeof(sim_stats));
+}
+
+int64_t sim_now_ns(void)
+{
+    return sim_ns;
+}
+
+void sim_advance_to(int64_t ns)
+{
+    if (ns > sim_ns)
+        sim_ns = ns;
+}
+
+void sim_get_stats(struct sim_pcm_stats *stats)
+{
+    *stats = sim_stats;
+}
+
+int sim_usleep(useconds_t us)
+{
+    sim_stats.sleeps++;
+    sim_stats.sleep_us += us;
+    sim_ns += (int64_t)us * 1000;
+    return 0;
+}
+
+int sim_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+    /* CPU time clocks stay real, the HAL measures its own cost with them */
+    if (clock != CLOCK_MONOTONIC)
+        return clock_gettime(clock, ts);
+
+    ts->tv_sec = sim_ns / NS_PER_SEC;
+    ts->tv_nsec = sim_ns % NS_PER_SEC;
+    return 0;
+}
+
+/* Frames played or captured by the device since the PCM started */
+static uint64_t pcm_elapsed_frames(const struct pcm *pcm)
+{
+    return (uint64_t)(sim_ns - pcm->start_ns) * pcm->config.rate / NS_PER_SEC;
+}
+
+/* First time at which frames have been played or captured */
+static int64_t pcm_time_of(const struct pcm *pcm, uint64_t frames)
+{
+    return pcm->start_ns +
+            (int64_t)((frames * NS_PER_SEC + pcm->config.rate - 1) / pcm->config.rate);
+}
+
+struct pcm *pcm_open(unsigned int card, unsigned int device, unsigned int flags,
+                     struct pcm_config *config)
+{
+    struct pcm *pcm = calloc(1, sizeof(struct pcm));
+
+    (void)card;
+    (void)device;
+    if (!pcm)
+        return NULL;
+
+    pcm->config = *config;
+    pcm->flags = flags;
+    /* tinyalsa defaults */
+    if (!pcm->config.start_threshold)
+        pcm->config.start_threshold = (flags & PCM_IN) ? 1 :
+                config->period_count * config->period_size / 2;
+
+    sim_stats.pcm_opens++;
+    if (flags & PCM_IN)
+        sim_stats.in_rate = config->rate;
+    else
+        sim_stats.out_rate = config->rate;
+
+    return pcm;
+}
+
+int pcm_close(struct pcm *pcm)
+{
+    free(pcm);
+    return 0;
+}
+
+int pcm_is_ready(struct pcm *pcm)
+{
+    return pcm != NULL;
+}
+
+const char *pcm_get_error(struct pcm *pcm)
+{
+    (void)pcm;
+    return "";
+}
+
+unsigned int pcm_get_buffer_size(struct pcm *pcm)
+{
+    return pcm->config.period_size * pcm->config.period_count;
+}
+
+unsigned int pcm_frames_to_bytes(struct pcm *pcm, unsigned int frames)
+{
+    return frames * pcm->config.channels * 2;
+}
+
+int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail, struct timespec *tstamp)
+{
+    uint64_t elapsed;
+
+    if (!pcm->running)
+        return -1;
+
+    elapsed = pcm_elapsed_frames(pcm);
+    if (pcm->flags & PCM_IN) {
+        *avail = (unsigned int)(elapsed - pcm->frames);
+    } else {
+        /* ran empty, the state is XRUN until the next write */
+        if (elapsed > pcm->frames)
+            return -1;
+        *avail = pcm_get_buffer_size(pcm) - (unsigned int)(pcm->frames - elapsed);
+    }
+
+    return sim_clock_gettime(CLOCK_MONOTONIC, tstamp);
+}
+
+int pcm_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+    unsigned int frames = count / pcm_frames_to_bytes(pcm, 1);
+    unsigned int buffer_size = pcm_get_buffer_size(pcm);
+    uint64_t queued;
+    unsigned int queued_us;
+
+    (void)data;
+
+    if (pcm->running && pcm_elapsed_frames(pcm) > pcm->frames) {
+        sim_stats.underruns++;
+        pcm->running = false;
+        pcm->frames = 0;
+        if (pcm->flags & PCM_NORESTART)
+            return -EPIPE;
+    }
+
+    if (pcm->running) {
+        /* blocks until the device has made room */
+        if (pcm->frames + frames > buffer_size)
+            sim_advance_to(pcm_time_of(pcm, pcm->frames + frames - buffer_size));
+        pcm->frames += frames;
+        queued = pcm->frames - pcm_elapsed_frames(pcm);
+    } else {
+        pcm->frames += frames;
+        queued = pcm->frames;
+        if (pcm->frames >= pcm->config.start_threshold) {
+            pcm->running = true;
+            pcm->start_ns = sim_ns;
+        }
+    }
+
+    queued_us = (unsigned int)(queued * 1000000 / pcm->config.rate);
+    sim_stats.writes++;
+    sim_stats.queued_us_sum += queued_us;
+    if (queued_us > sim_stats.max_queued_us)
+        sim_stats.max_queued_us = queued_us;
+
+    return 0;
+}
+
+int pcm_read(struct pcm *pcm, void *data, unsigned int count)
+{
+    unsigned int frames = count / pcm_frames_to_bytes(pcm, 1);
+
+    if (!pcm->running) {
+        pcm->running = true;
+        pcm->start_ns = sim_ns;
+        pcm->frames = 0;
+    }
+
+    if (pcm_elapsed_frames(pcm) - pcm->frames > pcm_get_buffer_size(pcm)) {
+        sim_stats.overruns++;
+        pcm->start_ns = sim_ns;
+        pcm->frames = 0;
+    }
+
+    /* blocks until the device has captured enough */
+    sim_advance_to(pcm_time_of(pcm, pcm->frames + frames));
+    pcm->frames += frames;
+    memset(data, 0, count);
+
+    return 0;
+}
+
+/* The mixer paths only matter on the device */
+
+struct audio_route {
+    int unused;
+};
+
+struct audio_route *audio_route_init(unsigned int card, const char *xml_path)
+{
+    (void)card;
+    (void)xml_path;
+    return calloc(1, sizeof(struct audio_route));
+}
+
+void audio_route_free(struct audio_route *ar)
+{
+    free(ar);
+}
+
+int audio_route_apply_path(struct audio_route *ar, const char *name)
+{
+    (void)ar;
+    (void)name;
+    return 0;
+}
+
+void audio_route_reset(struct audio_route *ar)
+{
+    (void)ar;
+}
+
+int audio_route_update_mixer(struct audio_route *ar)
+{
+    (void)ar;
+    return 0;
+}
+
+/*
+ * Zero order hold resampler: the replay checks timing, not audio, and
+ * only needs the frame counts of the real resampler.
+ */
+struct sim_resampler {
+    struct resampler_itfe itfe;
+    uint32_t in_rate;
+    uint32_t out_rate;
+    uint32_t channels;
+    struct resampler_buffer_provider *provider;
+    uint32_t acc;       /* input position, in 1/out_rate frames */
+};
+
+static void sim_resampler_reset(struct resampler_itfe *resampler)
+{
+    ((struct sim_resampler *)resampler)->acc = 0;
+}
+
+static int sim_resample_from_input(struct resampler_itfe *resampler,
+                                   int16_t *in, size_t *inFrameCount,
+                                   int16_t *out, size_t *outFrameCount)
+{
+    struct sim_resampler *rsmp = (struct sim_resampler *)resampler;
+    size_t i = 0, o = 0;
+
+    while (rsmp->acc >= rsmp->out_rate && i < *inFrameCount) {
+        rsmp->acc -= rsmp->out_rate;
+        i++;
+    }
+    while (o < *outFrameCount && i < *inFrameCount) {
+        memcpy(out + o * rsmp->channels, in + i * rsmp->channels,
+               rsmp->channels * sizeof(int16_t));
+        o++;
+        rsmp->acc += rsmp->in_rate;
+        while (rsmp->acc >= rsmp->out_rate && i < *inFrameCount) {
+            rsmp->acc -= rsmp->out_rate;
+            i++;
+        }
+    }
+
+    *inFrameCount = i;
+    *outFrameCount = o;
+    return 0;
+}
+
+static int sim_resample_from_provider(struct resampler_itfe *resampler,
+                                      int16_t *out, size_t *outFrameCount)
+{
+    struct sim_resampler *rsmp = (struct sim_resampler *)resampler;
+    size_t o = 0;
+
+    if (!rsmp->provider)
+        return -EINVAL;
+
+    while (o < *outFrameCount) {
+        struct resampler_buffer buf;
+        size_t in_frames, out_frames = *outFrameCount - o;
+
+        buf.frame_count = out_frames * rsmp->in_rate / rsmp->out_rate + 1;
+        if (rsmp->provider->get_next_buffer(rsmp->provider, &buf) != 0 ||
+                buf.frame_count == 0)
+            break;
+
+        in_frames = buf.frame_count;
+        sim_resample_from_input(resampler, buf.i16, &in_frames,
+                                out + o * rsmp->channels, &out_frames);
+        buf.frame_count = in_frames;
+        rsmp->provider->release_buffer(rsmp->provider, &buf);
+        o += out_frames;
+    }
+
+    *outFrameCount = o;
+    return 0;
+}
+
+static int32_t sim_resampler_delay_ns(struct resampler_itfe *resampler)
+{
+    (void)resampler;
+    return 0;
+}
+
+int create_resampler(uint32_t inSampleRate, uint32_t outSampleRate,
+                     uint32_t channelCount, uint32_t quality,
+                     struct resampler_buffer_provider *provider,
+                     struct resampler_itfe **resampler)
+{
+    struct sim_resampler *rsmp = calloc(1, sizeof(struct sim_resampler));
+
+    (void)quality;
+    if (!rsmp)
+        return -ENOMEM;
+
+    rsmp->itfe.reset = sim_resampler_reset;
+    rsmp->itfe.resample_from_provider = sim_resample_from_provider;
+    rsmp->itfe.resample_from_input = sim_resample_from_input;
+    rsmp->itfe.delay_ns = sim_resampler_delay_ns;
+    rsmp->in_rate = inSampleRate;
+    rsmp->out_rate = outSampleRate;
+    rsmp->channels = channelCount;
+    rsmp->provider = provider;
+
+    *resampler = &rsmp->itfe;
+    return 0;
+}
+
+void release_resampler(struct resampler_itfe *resampler)
+{
+    free(resampler);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_HW_SIM_PCM_H
+#define AUDIO_HW_SIM_PCM_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Simulated tinyalsa for replaying HAL traces on a host. The HAL under
+ * test is built by audio_hw_sim.c with usleep() and clock_gettime()
+ * redirected here, so time only advances when the HAL sleeps, a PCM
+ * blocks or the replayer waits for the next record: a replay is
+ * deterministic and runs much faster than real time.
+ *
+ * The output PCM drains at its rate once the start threshold is reached
+ * and underruns when it runs empty; the input PCM fills at its rate from
+ * the first read and overruns when it is not read in time.
+ */
+struct sim_pcm_stats {
+    unsigned int pcm_opens;
+    unsigned int underruns;
+    unsigned int overruns;
+    unsigned int sleeps;        /* usleep() calls made by the HAL */
+    uint64_t sleep_us;
+    unsigned int writes;
+    unsigned int max_queued_us;         /* output kernel queue after a write */
+    uint64_t queued_us_sum;             /* summed over writes */
+    unsigned int out_rate;              /* rate of the last output PCM opened */
+    unsigned int in_rate;               /* rate of the last input PCM opened */
+};
+
+void sim_reset(void);
+int64_t sim_now_ns(void);
+/* advances the simulated time, never moves it back */
+void sim_advance_to(int64_t ns);
+void sim_get_stats(struct sim_pcm_stats *stats);
+
+int sim_usleep(useconds_t us);
+int sim_clock_gettime(clockid_t clock, struct timespec *ts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_HW_SIM_PCM_H */
@@ -189,6 +189,11 @@ PRODUCT_COPY_FILES += \
 PRODUCT_COPY_FILES += \
     device/asus/grouper/audio_policy.conf:system/etc/audio_policy.conf
 
+# power HAL boost and app profiles
+PRODUCT_COPY_FILES += \
+    device/asus/grouper/power_profiles.conf:system/vendor/etc/power_profiles.conf \
+    device/asus/grouper/power_app_profiles.conf:system/vendor/etc/power_app_profiles.conf
+
 PRODUCT_COPY_FILES += \
     frameworks/native/data/etc/android.hardware.nfc.xml:system/etc/permissions/android.hardware.nfc.xml
 
@@ -15,18 +15,108 @@
 
 LOCAL_PATH := $(call my-dir)
 
+power_grouper_src_files := \
+	tegra3_power.cpp nvpowerhal.cpp powerhal_utils.cpp powerhal_profiles.cpp \
+	powerhal_input.cpp powerhal_stats.cpp powerhal_vsync.cpp \
+	powerhal_cpuquiet.cpp powerhal_thermal.cpp powerhal_sustained.cpp \
+	powerhal_launch.cpp timeoutpoker.cpp
+
+power_grouper_cflags :=
+ifeq ($(shell test $(PLATFORM_SDK_VERSION) -ge 20 || echo 1),)
+power_grouper_cflags += -DANDROID_API_LP_OR_LATER
+endif
+
 # HAL module implemenation stored in
 # hw/<POWERS_HARDWARE_MODULE_ID>.<ro.hardware>.so
 include $(CLEAR_VARS)
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_VENDOR_SHARED_LIBRARIES)/hw
 LOCAL_SHARED_LIBRARIES := liblog libcutils libutils libdl
-LOCAL_SRC_FILES := tegra3_power.cpp nvpowerhal.cpp powerhal_utils.cpp timeoutpoker.cpp
+LOCAL_SRC_FILES := $(power_grouper_src_files)
 LOCAL_MODULE := power.grouper
 LOCAL_MODULE_TAGS := optional
-
-ifeq ($(shell test $(PLATFORM_SDK_VERSION) -ge 20 || echo 1),)
-LOCAL_CFLAGS += -DANDROID_API_LP_OR_LATER
-endif
+LOCAL_CFLAGS += $(power_grouper_cflags)
 
 include $(BUILD_SHARED_LIBRARY)
+
+
+# Replays the hint traces of tests/traces against the HAL on a fake
+# sysfs/devfs tree, see tests/hal_replay.h, simulates learned launch and
+# graded interaction boosts against fixed ones, models launch frame times
+# with and without the gpu floor and checks the HAL starts one poker thread
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := power_grouper_replay_test
+LOCAL_SRC_FILES := \
+	$(power_grouper_src_files) \
+	tests/power_hal_replay_test.cpp \
+	tests/power_launch_sim_test.cpp \
+	tests/power_interaction_sim_test.cpp \
+	tests/power_launch_frames_test.cpp \
+	tests/power_hal_init_test.cpp \
+	tests/hal_replay.cpp \
+	tests/tegra3_model.cpp \
+	tests/bench_counters.cpp \
+	tests/fake_tree.cpp \
+	tests/write_recorder.cpp
+LOCAL_CFLAGS += $(power_grouper_cflags) -DPOWER_TRACE_DIR=\"$(LOCAL_PATH)/tests/traces\"
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS := -lpthread
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+
+# Request to write latency of TimeoutPoker on the fake tree, with the
+# allocations and syscalls per request
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := timeoutpoker_benchmark
+LOCAL_SRC_FILES := \
+	timeoutpoker.cpp \
+	powerhal_utils.cpp \
+	tests/timeoutpoker_benchmark.cpp \
+	tests/bench_counters.cpp \
+	tests/fake_tree.cpp \
+	tests/write_recorder.cpp
+LOCAL_CFLAGS += $(power_grouper_cflags)
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS := -lpthread
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+
+# powerHint() from several threads against the fake tree, with the hint
+# to cpu_freq_min latency and the allocations and syscalls per hint. Run
+# it on the host and on the device to compare TimeoutPoker versions.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := powerhal_benchmark
+LOCAL_SRC_FILES := \
+	$(power_grouper_src_files) \
+	tests/powerhal_benchmark.cpp \
+	tests/bench_counters.cpp \
+	tests/fake_tree.cpp \
+	tests/write_recorder.cpp
+LOCAL_CFLAGS += $(power_grouper_cflags)
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS := -lpthread
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := powerhal_benchmark
+LOCAL_SRC_FILES := \
+	$(power_grouper_src_files) \
+	tests/powerhal_benchmark.cpp \
+	tests/bench_counters.cpp \
+	tests/fake_tree.cpp \
+	tests/write_recorder.cpp
+LOCAL_CFLAGS += $(power_grouper_cflags)
+LOCAL_SHARED_LIBRARIES := liblog libcutils libutils
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
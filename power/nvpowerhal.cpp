@@ -31,7 +31,7 @@ static int get_input_count(void)
     while(1)
     {
         snprintf(path, sizeof(path), "/sys/class/input/input%d/name", i);
-        ret = access(path, F_OK);
+        ret = powerhal_access(path, F_OK);
         if (ret < 0)
             break;
         memset(name, 0, 50);
@@ -52,7 +52,7 @@ static void find_input_device_ids(struct powerhal_info *pInfo)
     while (1)
     {
         snprintf(path, sizeof(path), "/sys/class/input/input%d/name", i);
-        if (access(path, F_OK) < 0)
+        if (powerhal_access(path, F_OK) < 0)
             break;
         else {
             memset(name, 0, MAX_CHARS);
@@ -90,11 +90,12 @@ static int check_hint(struct powerhal_info *pInfo, power_hint_t hint, uint64_t *
     clock_gettime(CLOCK_MONOTONIC, &ts);
     time = ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 
+    *t = time;
+
+    // Rate limited
     if (pInfo->hint_time[hint] && pInfo->hint_interval[hint] &&
         (time - pInfo->hint_time[hint] < pInfo->hint_interval[hint]))
-        return -1;
-
-    *t = time;
+        return 1;
 
     return 0;
 }
@@ -111,53 +112,86 @@ static bool is_available_frequency(struct powerhal_info *pInfo, int freq)
     return false;
 }
 
+/* Parses a list of numbers, only counting them when freqs is NULL */
+static int parse_frequencies(const char *buf, int *freqs)
+{
+    const char *p = buf;
+    char *end;
+    int n = 0;
+
+    for (;;) {
+        long freq = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        if (freqs)
+            freqs[n] = freq;
+        n++;
+        p = end;
+    }
+
+    return n;
+}
+
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+
+TimeoutPoker* get_timeout_poker(struct powerhal_info *pInfo)
+{
+    TimeoutPoker* poker = __atomic_load_n(&pInfo->mTimeoutPoker, __ATOMIC_ACQUIRE);
+
+    if (poker)
+        return poker;
+
+    pthread_mutex_lock(&open_lock);
+    poker = pInfo->mTimeoutPoker;
+    if (!poker) {
+        Barrier readyToRun;
+        poker = new TimeoutPoker(&readyToRun);
+        readyToRun.wait();
+        __atomic_store_n(&pInfo->mTimeoutPoker, poker, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&open_lock);
+
+    return poker;
+}
+
 void common_power_open(struct powerhal_info *pInfo)
 {
     int i;
     int size = 256;
-    char *pch;
+
+    pthread_mutex_lock(&open_lock);
+    if (pInfo->opened) {
+        pthread_mutex_unlock(&open_lock);
+        return;
+    }
 
     if (0 == pInfo->input_devs || 0 == pInfo->input_cnt)
         pInfo->input_cnt = get_input_count();
     else
         find_input_device_ids(pInfo);
 
-    // Initialize timeout poker
-    Barrier readyToRun;
-    pInfo->mTimeoutPoker = new TimeoutPoker(&readyToRun);
-    readyToRun.wait();
-
-    // Read available frequencies
+    // Read available frequencies into a lookup array
     char *buf = (char*)malloc(sizeof(char) * size);
     memset(buf, 0, size);
     sysfs_read("/sys/devices/system/cpu/cpu0/cpufreq/scaling_available_frequencies",
-               buf, size);
-
-    // Determine number of available frequencies
-    pch = strtok(buf, " ");
-    pInfo->num_available_frequencies = -1;
-    while(pch != NULL)
-    {
-        pch = strtok(NULL, " ");
-        pInfo->num_available_frequencies++;
-    }
-
-    // Store available frequencies in a lookup array
-    pInfo->available_frequencies = (int*)malloc(sizeof(int) * pInfo->num_available_frequencies);
-    sysfs_read("/sys/devices/system/cpu/cpu0/cpufreq/scaling_available_frequencies",
-               buf, size);
-    pch = strtok(buf, " ");
-    for(i = 0; i < pInfo->num_available_frequencies; i++)
-    {
-        pInfo->available_frequencies[i] = atoi(pch);
-        pch = strtok(NULL, " ");
+               buf, size - 1);
+    pInfo->num_available_frequencies = parse_frequencies(buf, NULL);
+    if (pInfo->num_available_frequencies <= 0) {
+        ALOGE("No cpu frequencies available");
+        pInfo->num_available_frequencies = 1;
+        pInfo->available_frequencies = (int*)malloc(sizeof(int));
+        pInfo->available_frequencies[0] = 0;
+    } else {
+        pInfo->available_frequencies = (int*)malloc(sizeof(int) * pInfo->num_available_frequencies);
+        parse_frequencies(buf, pInfo->available_frequencies);
     }
 
     pInfo->max_frequency = pInfo->available_frequencies[pInfo->num_available_frequencies - 1];
 
     // Store LP cluster max frequency
+    memset(buf, 0, size);
     sysfs_read("/sys/devices/system/cpu/cpuquiet/tegra_cpuquiet/idle_top_freq",
-                buf, size);
+                buf, size - 1);
     pInfo->lp_max_frequency = atoi(buf);
 
     pInfo->interaction_boost_frequency = pInfo->lp_max_frequency;
@@ -179,32 +213,281 @@ void common_power_open(struct powerhal_info *pInfo)
         }
     }
 
-    // Initialize hint intervals in usec
-    //
-    // Set the interaction timeout to be slightly shorter than the duration of
-    // the interaction boost so that we can maintain is constantly during
-    // interaction.
-    pInfo->hint_interval[POWER_HINT_VSYNC] = 100000;
-    pInfo->hint_interval[POWER_HINT_INTERACTION] = 100000;
-    pInfo->hint_interval[POWER_HINT_LAUNCH] = 2000000;
+    // Boost profiles and hint intervals
+    load_hint_profiles(pInfo);
+    load_app_profiles(pInfo);
+    vsync_governor_init(pInfo);
+    pInfo->thermal_headroom.store(INT32_MAX);
+    pthread_mutex_init(&pInfo->interaction_lock, NULL);
+    pthread_mutex_init(&pInfo->low_power.lock, NULL);
+    pInfo->low_power.cpu_freq_fd = -1;
+    pInfo->low_power.online_cpus_fd = -1;
+    pInfo->low_power.gpu_freq_fd = -1;
+    pthread_mutex_init(&pInfo->apps.lock, NULL);
+    pthread_mutex_init(&pInfo->launches.lock, NULL);
+    pInfo->fds.app_min_cpus = -1;
+    pInfo->fds.app_max_cpus = -1;
+    pInfo->fds.app_max_freq = -1;
+    pInfo->fds.app_gpu_min = -1;
 
     free(buf);
+
+    pInfo->opened = true;
+    pthread_mutex_unlock(&open_lock);
+}
+
+/*
+ * Holds the boot boost until sys.boot_completed is set, polled on the
+ * poker thread, or until BOOT_BOOST_MAX_S. The handles are closed when
+ * the poker deletes the task.
+ */
+class BootBoost : public TimeoutPoker::Task {
+public:
+    BootBoost(int freqFd, int cpusFd) :
+        mFreqFd(freqFd),
+        mCpusFd(cpusFd),
+        mStart(systemTime(SYSTEM_TIME_MONOTONIC)) {}
+
+    virtual ~BootBoost() {
+        if (mFreqFd >= 0)
+            close(mFreqFd);
+        if (mCpusFd >= 0)
+            close(mCpusFd);
+    }
+
+    virtual nsecs_t run(nsecs_t now) {
+        bool completed = get_property_bool("sys.boot_completed", false);
+
+        if (!completed && now - mStart < s2ns(BOOT_BOOST_MAX_S))
+            return ms2ns(BOOT_BOOST_POLL_MS);
+
+        ALOGI("Releasing boot boost after %lld ms, boot %s",
+                (long long)ns2ms(now - mStart), completed ? "completed" : "timed out");
+        return 0;
+    }
+
+private:
+    int mFreqFd;
+    int mCpusFd;
+    nsecs_t mStart;
+};
+
+static void start_boot_boost(struct powerhal_info *pInfo)
+{
+    TimeoutPoker* poker = get_timeout_poker(pInfo);
+    int freqFd, cpusFd;
+
+    // HAL restarted after boot
+    if (get_property_bool("sys.boot_completed", false))
+        return;
+
+    freqFd = poker->createPmQosHandle("/dev/cpu_freq_min", pInfo->max_frequency);
+    cpusFd = poker->createPmQosHandle("/dev/min_online_cpus", DEFAULT_MAX_ONLINE_CPUS);
+    BootBoost* boost = new BootBoost(freqFd, cpusFd);
+    boost->category = BOOST_CATEGORY_BOOT;
+    poker->postTask(boost, ms2ns(BOOT_BOOST_POLL_MS));
+    ALOGI("Boosting cpu_freq_min to %d until boot completes", pInfo->max_frequency);
 }
 
 void common_power_init(__attribute__ ((unused)) struct power_module *module,
         struct powerhal_info *pInfo)
 {
-    ALOGI("common_power_open ... ");
     common_power_open(pInfo);
 
+    pthread_mutex_lock(&open_lock);
+    if (pInfo->initialized) {
+        pthread_mutex_unlock(&open_lock);
+        return;
+    }
+    pInfo->initialized = true;
+    pthread_mutex_unlock(&open_lock);
+
     pInfo->ftrace_enable = get_property_bool("nvidia.hwc.ftrace_enable", false);
 
     // Boost to max frequency on initialization to decrease boot time
-    pInfo->mTimeoutPoker->requestPmQosTimed("/dev/cpu_freq_min", pInfo->max_frequency,
-                                     s2ns(60));
-    pInfo->mTimeoutPoker->requestPmQosTimed("/dev/min_online_cpus", DEFAULT_MAX_ONLINE_CPUS,
-                                     s2ns(60));
-    ALOGI("Boosting cpu_freq_min to %d for 60 seconds to make boot faster", pInfo->max_frequency);
+    start_boot_boost(pInfo);
+
+    start_input_monitor(pInfo);
+    start_cpuquiet_tuner(pInfo);
+    start_thermal_sampler(pInfo);
+
+    if (get_property_bool(SUSTAINED_PROP, false))
+        sustained_mode_set(pInfo, true);
+}
+
+void cap_boost(struct powerhal_info *pInfo, int *freq, int *min_cpus)
+{
+    int thermal_max = pInfo->thermal_max_frequency.load();
+
+    // The sustained level is pinned, spikes would only heat it up
+    if (pInfo->sustained.active.load()) {
+        *freq = 0;
+        *min_cpus = 0;
+        return;
+    }
+
+    if (thermal_max && *freq > thermal_max)
+        *freq = thermal_max;
+
+    if (!pInfo->low_power.enabled)
+        return;
+
+    if (*freq > pInfo->low_power.max_frequency)
+        *freq = pInfo->low_power.max_frequency;
+    if (*min_cpus > LOW_POWER_MAX_ONLINE_CPUS)
+        *min_cpus = LOW_POWER_MAX_ONLINE_CPUS;
+}
+
+/*
+ * Holds a ceiling through the priority constraint node, or through the
+ * plain *_max node on kernels without constraint nodes. Returns the
+ * handle, closing it drops the ceiling.
+ */
+static int request_ceiling(struct powerhal_info *pInfo, const char *constraint,
+        const char *node, int max, int priority)
+{
+    int fd = -1;
+
+    if (!powerhal_access(constraint, W_OK))
+        fd = get_timeout_poker(pInfo)->createPmQosHandle(constraint,
+                priority, max, PM_QOS_DEFAULT_VALUE);
+    if (fd < 0 && !powerhal_access(node, W_OK))
+        fd = get_timeout_poker(pInfo)->createPmQosHandle(node, max);
+
+    return fd;
+}
+
+/*
+ * The LP cluster is allowed while nobody is looking, in low power mode
+ * and while the app in front is held at LP cluster frequencies.
+ */
+static bool lp_allowed(struct powerhal_info *pInfo, bool interactive)
+{
+    const struct app_profile *app = pInfo->apps.current;
+
+    if (!interactive || pInfo->low_power.enabled)
+        return true;
+
+    return app && app->max_freq && app->max_freq <= pInfo->lp_max_frequency;
+}
+
+static void release_app_limits(struct powerhal_info *pInfo)
+{
+    int *fds[] = { &pInfo->fds.app_min_cpus, &pInfo->fds.app_max_cpus,
+                   &pInfo->fds.app_max_freq, &pInfo->fds.app_gpu_min };
+
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+}
+
+/* Replaces the held app limits with those of app, apps.lock held */
+static void hold_app_limits(struct powerhal_info *pInfo, const struct app_profile *app)
+{
+    TimeoutPoker* poker = get_timeout_poker(pInfo);
+    int freq = 0;
+    int min_cpus;
+
+    release_app_limits(pInfo);
+    if (!app)
+        return;
+
+    // Floors go through the same caps as boosts, ceilings always apply
+    min_cpus = app->min_cpus;
+    cap_boost(pInfo, &freq, &min_cpus);
+    if (min_cpus)
+        pInfo->fds.app_min_cpus = poker->createPmQosHandle("/dev/min_online_cpus",
+                min_cpus);
+    if (app->gpu_min && !pInfo->low_power.enabled && !pInfo->sustained.active.load())
+        pInfo->fds.app_gpu_min = poker->createPmQosHandle("/dev/gpu_freq_min",
+                app->gpu_min);
+    if (app->max_cpus)
+        pInfo->fds.app_max_cpus = request_ceiling(pInfo,
+                "/dev/constraint_online_cpus", "/dev/max_online_cpus",
+                app->max_cpus, APP_QOS_PRIORITY);
+    if (app->max_freq)
+        pInfo->fds.app_max_freq = request_ceiling(pInfo,
+                "/dev/constraint_cpu_freq", "/dev/cpu_freq_max",
+                app->max_freq, APP_QOS_PRIORITY);
+}
+
+/* Re-evaluates the held app limits after a mode change */
+static void refresh_app_limits(struct powerhal_info *pInfo)
+{
+    pthread_mutex_lock(&pInfo->apps.lock);
+    if (pInfo->interactive)
+        hold_app_limits(pInfo, pInfo->apps.current);
+    pthread_mutex_unlock(&pInfo->apps.lock);
+}
+
+/*
+ * Makes the profile of package current, NULL when it has none. Its
+ * limits are held until the next launch, except while the screen is
+ * off. Returns the profile.
+ */
+static const struct app_profile *launch_app(struct powerhal_info *pInfo,
+        const char *package)
+{
+    const struct app_profile *app = find_app_profile(pInfo, package);
+
+    pthread_mutex_lock(&pInfo->apps.lock);
+    if (app != pInfo->apps.current) {
+        pInfo->apps.current = app;
+        if (pInfo->interactive)
+            hold_app_limits(pInfo, app);
+        sysfs_write("/sys/devices/system/cpu/cpuquiet/tegra_cpuquiet/no_lp",
+                lp_allowed(pInfo, pInfo->interactive) ? "0" : "1");
+        ALOGV("App profile %s", app ? app->package : "none");
+    }
+    pthread_mutex_unlock(&pInfo->apps.lock);
+
+    return app;
+}
+
+static void set_low_power(struct powerhal_info *pInfo, bool enable)
+{
+    pthread_mutex_lock(&pInfo->low_power.lock);
+    if (enable == pInfo->low_power.enabled) {
+        pthread_mutex_unlock(&pInfo->low_power.lock);
+        return;
+    }
+
+    if (enable) {
+        pInfo->low_power.max_frequency = pInfo->animation_boost_frequency;
+        pInfo->low_power.cpu_freq_fd = request_ceiling(pInfo,
+                "/dev/constraint_cpu_freq", "/dev/cpu_freq_max",
+                pInfo->low_power.max_frequency, LOW_POWER_QOS_PRIORITY);
+        pInfo->low_power.online_cpus_fd = request_ceiling(pInfo,
+                "/dev/constraint_online_cpus", "/dev/max_online_cpus",
+                LOW_POWER_MAX_ONLINE_CPUS, LOW_POWER_QOS_PRIORITY);
+        pInfo->low_power.gpu_freq_fd = request_ceiling(pInfo,
+                "/dev/constraint_gpu_freq", "/dev/gpu_freq_max",
+                LOW_POWER_GPU_MAX_FREQ, LOW_POWER_QOS_PRIORITY);
+        // Let cpuquiet fall back to the LP core
+        sysfs_write("/sys/devices/system/cpu/cpuquiet/tegra_cpuquiet/no_lp", "0");
+    } else {
+        if (pInfo->low_power.cpu_freq_fd >= 0)
+            close(pInfo->low_power.cpu_freq_fd);
+        if (pInfo->low_power.online_cpus_fd >= 0)
+            close(pInfo->low_power.online_cpus_fd);
+        if (pInfo->low_power.gpu_freq_fd >= 0)
+            close(pInfo->low_power.gpu_freq_fd);
+        pInfo->low_power.cpu_freq_fd = -1;
+        pInfo->low_power.online_cpus_fd = -1;
+        pInfo->low_power.gpu_freq_fd = -1;
+    }
+
+    pInfo->low_power.enabled = enable;
+    if (!enable)
+        sysfs_write("/sys/devices/system/cpu/cpuquiet/tegra_cpuquiet/no_lp",
+                lp_allowed(pInfo, pInfo->interactive) ? "0" : "1");
+    pthread_mutex_unlock(&pInfo->low_power.lock);
+    ALOGI("Low power mode %s", enable ? "on" : "off");
+
+    // The app floors are capped in low power mode
+    refresh_app_limits(pInfo);
 }
 
 void common_power_set_interactive(__attribute__ ((unused)) struct power_module *module,
@@ -214,18 +497,24 @@ void common_power_set_interactive(__attribute__ ((unused)) struct power_module *
     int dev_id;
     char path[80];
     const char* state = (0 == on)?"0":"1";
-    const char* lp_state = (on)?"1":"0";
+    const char* lp_state = (on && !(pInfo && lp_allowed(pInfo, on)))?"1":"0";
     const char* gov = (on == 0)?"intelliactive":"intelliactive";
 
-    ALOGI("common_power_open_set_interactive ... ");
-    sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor", gov);
-    ALOGI("Setting scaling_governor to %s", gov);
+    ALOGV("common_power_open_set_interactive ... ");
+    if (pInfo)
+        pInfo->interactive = on;
+    // A governor switch recreates its tunables, forget what was written.
+    // Rewriting the current governor is skipped and keeps them.
+    if (sysfs_write("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor", gov)) {
+        ALOGV("Setting scaling_governor to %s", gov);
+        sysfs_invalidate("/sys/devices/system/cpu/cpufreq/intelliactive/");
+    }
 
     sysfs_write("/sys/devices/system/cpu/cpuquiet/tegra_cpuquiet/no_lp", lp_state);
-    ALOGI("Setting low power cluster %s", lp_state);
+    ALOGV("Setting low power cluster %s", lp_state);
 
     if (0 != pInfo) {
-        ALOGI("pInfo available ... ");
+        ALOGV("pInfo available ... ");
         for (i = 0; i < pInfo->input_cnt; i++) {
             if (0 == pInfo->input_devs)
                 dev_id = i;
@@ -234,83 +523,267 @@ void common_power_set_interactive(__attribute__ ((unused)) struct power_module *
             else
                 dev_id = pInfo->input_devs[i].dev_id;
             snprintf(path, sizeof(path), "/sys/class/input/input%d/enabled", dev_id);
-            if (!access(path, W_OK)) {
+            if (!powerhal_access(path, W_OK)) {
                 if (0 == on)
-                    ALOGI("Disabling input device:%d", dev_id);
+                    ALOGV("Disabling input device:%d", dev_id);
                 else
-                    ALOGI("Enabling input device:%d", dev_id);
+                    ALOGV("Enabling input device:%d", dev_id);
                 sysfs_write(path, state);
             }
         }
     }
 
     if ( on != 0 ) {
-        ALOGI("Screen is off going to be switched on, setting aggressive values for intelliactive governor and boost wake up");
+        ALOGV("Screen is off going to be switched on, setting aggressive values for intelliactive governor and boost wake up");
         sysfs_write_int("/sys/devices/system/cpu/cpufreq/intelliactive/io_is_busy", 1);
-        sysfs_write_int("/sys/devices/system/cpu/cpufreq/intelliactive/boostpulse", 1);
+        sysfs_write_int_trigger("/sys/devices/system/cpu/cpufreq/intelliactive/boostpulse", 1);
         if (0 != pInfo) {
-            ALOGI("dealing with wake up -> boosting CPU for 5s");
-            pInfo->mTimeoutPoker->requestPmQosTimed("/dev/cpu_freq_min",
-                                                     pInfo->max_frequency,
-                                                     s2ns(5));
-            pInfo->mTimeoutPoker->requestPmQosTimed("/dev/min_online_cpus",
-                                                     DEFAULT_MAX_ONLINE_CPUS,
-                                                     s2ns(5));
+            int freq = pInfo->max_frequency;
+            int min_cpus = DEFAULT_MAX_ONLINE_CPUS;
+
+            ALOGV("dealing with wake up -> boosting CPU for 5s");
+            cap_boost(pInfo, &freq, &min_cpus);
+            get_timeout_poker(pInfo)->requestPmQosTimed("/dev/cpu_freq_min",
+                                                        freq,
+                                                        s2ns(5),
+                                                        BOOST_CATEGORY_WAKE);
+            get_timeout_poker(pInfo)->requestPmQosTimed("/dev/min_online_cpus",
+                                                        min_cpus,
+                                                        s2ns(5),
+                                                        BOOST_CATEGORY_WAKE);
+
+            // The app in front is still the last one launched
+            refresh_app_limits(pInfo);
+
+            // Cancelled with the boosts on screen off
+            if (pInfo->sustained.active.load())
+                sustained_mode_set(pInfo, true);
        }
     }
 
+    if (on == 0 && 0 != pInfo) {
+        // Nobody is looking, drop the boosts instead of waiting them out
+        vsync_governor_set(pInfo, false);
+        get_timeout_poker(pInfo)->cancelPmQosTimed(BOOST_CATEGORY_ALL);
+        pthread_mutex_lock(&pInfo->interaction_lock);
+        pInfo->interaction_end = 0;
+        pInfo->interaction_freq = 0;
+        pthread_mutex_unlock(&pInfo->interaction_lock);
+        pthread_mutex_lock(&pInfo->apps.lock);
+        release_app_limits(pInfo);
+        pthread_mutex_unlock(&pInfo->apps.lock);
+
+        // Screen off is a quiet point to persist the day's telemetry
+        launch_tracker_stop(pInfo);
+        common_power_dump_stats(pInfo);
+        launch_history_save(pInfo);
+    }
+
+}
+
+/* GPU part of a profile, held as long as the cpu part */
+static void request_gpu_boost(struct powerhal_info *pInfo,
+        const struct hint_profile *p, int duration_ms)
+{
+    int gpu_min = p->gpu_min;
+
+    if (pInfo->sustained.active.load())
+        return;
+
+    if (pInfo->low_power.enabled && gpu_min > LOW_POWER_GPU_MAX_FREQ)
+        gpu_min = LOW_POWER_GPU_MAX_FREQ;
+
+    if (gpu_min)
+        get_timeout_poker(pInfo)->requestPmQosTimed("/dev/gpu_freq_min",
+                                                    gpu_min,
+                                                    ms2ns(duration_ms),
+                                                    BOOST_CATEGORY_HINT);
+    if (p->gpu_max)
+        get_timeout_poker(pInfo)->requestPmQosTimed("/dev/gpu_freq_max",
+                                                    p->gpu_max,
+                                                    ms2ns(duration_ms),
+                                                    BOOST_CATEGORY_HINT);
+}
+
+static void apply_hint_profile(struct powerhal_info *pInfo, const struct hint_profile *p)
+{
+    if (!p->duration_ms)
+        return;
+
+    int freq = p->freq;
+    int min_cpus = p->min_cpus;
+
+    cap_boost(pInfo, &freq, &min_cpus);
+    if (freq)
+        get_timeout_poker(pInfo)->requestPmQosTimed("/dev/cpu_freq_min",
+                                                    freq,
+                                                    ms2ns(p->duration_ms),
+                                                    BOOST_CATEGORY_HINT);
+    if (min_cpus)
+        get_timeout_poker(pInfo)->requestPmQosTimed("/dev/min_online_cpus",
+                                                    min_cpus,
+                                                    ms2ns(p->duration_ms),
+                                                    BOOST_CATEGORY_HINT);
+    request_gpu_boost(pInfo, p, p->duration_ms);
+}
+
+/*
+ * Launch profile, with the floor of the launched app if it sets one and
+ * held as long as launches of package used to take. package is NULL
+ * when the hint did not name it. The floors stay within the limits the
+ * app holds, PM QoS would let a floor above them win.
+ */
+static void launch_boost(struct powerhal_info *pInfo, const struct app_profile *app,
+        const char *package)
+{
+    struct hint_profile p = pInfo->profiles[POWER_HINT_LAUNCH];
+    int duration_ms;
+
+    if (!p.duration_ms)
+        return;
+
+    if (app && app->launch_freq)
+        p.freq = app->launch_freq;
+    if (app && app->max_freq && p.freq > app->max_freq)
+        p.freq = app->max_freq;
+    if (app && app->max_cpus && p.min_cpus > app->max_cpus)
+        p.min_cpus = app->max_cpus;
+    duration_ms = launch_boost_duration(pInfo, package);
+    if (duration_ms)
+        p.duration_ms = duration_ms;
+    apply_hint_profile(pInfo, &p);
+    launch_tracker_start(pInfo, package);
+}
+
+/*
+ * Grades the interaction boost by the expected duration passed by the
+ * framework: taps and gesture starts get interaction_boost_frequency for
+ * the profile duration, flings get the profile frequency on all cores
+ * for as long as the animation is expected to last. Returns false when
+ * the boost already running covers the request.
+ */
+static bool interaction_boost(struct powerhal_info *pInfo, int duration_ms, uint64_t now)
+{
+    const struct hint_profile *p = &pInfo->profiles[POWER_HINT_INTERACTION];
+    int freq = p->freq;
+    int min_cpus = p->min_cpus;
+    uint64_t end;
+
+    if (duration_ms >= INTERACTION_FLING_MS) {
+        if (duration_ms > INTERACTION_MAX_MS)
+            duration_ms = INTERACTION_MAX_MS;
+        min_cpus = DEFAULT_MAX_ONLINE_CPUS;
+    } else {
+        if (pInfo->interaction_boost_frequency < freq)
+            freq = pInfo->interaction_boost_frequency;
+        if (duration_ms < p->duration_ms)
+            duration_ms = p->duration_ms;
+    }
+
+    if (!duration_ms)
+        return false;
+
+    cap_boost(pInfo, &freq, &min_cpus);
+
+    end = now + (uint64_t)duration_ms * 1000;
+    if (end <= pInfo->interaction_end && freq <= pInfo->interaction_freq)
+        return false;
+
+    if (freq)
+        get_timeout_poker(pInfo)->requestPmQosTimed("/dev/cpu_freq_min",
+                                                    freq,
+                                                    ms2ns(duration_ms),
+                                                    BOOST_CATEGORY_HINT);
+    if (min_cpus)
+        get_timeout_poker(pInfo)->requestPmQosTimed("/dev/min_online_cpus",
+                                                    min_cpus,
+                                                    ms2ns(duration_ms),
+                                                    BOOST_CATEGORY_HINT);
+    request_gpu_boost(pInfo, p, duration_ms);
+
+    pInfo->interaction_end = end;
+    pInfo->interaction_freq = freq;
+    return true;
+}
+
+void common_power_touch_boost(struct powerhal_info *pInfo, uint64_t now)
+{
+    pthread_mutex_lock(&pInfo->interaction_lock);
+    if (interaction_boost(pInfo, 0, now))
+        pInfo->hint_time[POWER_HINT_INTERACTION] = now;
+    pthread_mutex_unlock(&pInfo->interaction_lock);
 }
 
 void common_power_hint(__attribute__ ((unused)) struct power_module *module,
-        struct powerhal_info *pInfo, power_hint_t hint, __attribute__ ((unused)) void *data)
+        struct powerhal_info *pInfo, power_hint_t hint, void *data)
 {
+    const struct app_profile *app = NULL;
+    const char *package = NULL;
     uint64_t t;
+    int ret;
 
     if (!pInfo)
         return;
 
-    if (check_hint(pInfo, hint, &t) < 0)
+#ifdef ANDROID_API_LP_OR_LATER
+    // Launches naming the package switch app profiles, even when the
+    // boost itself ends up rate limited
+    if (hint == POWER_HINT_LAUNCH_BOOST) {
+        const launch_boost_info_t *info = (const launch_boost_info_t *)data;
+
+        package = info ? info->packageName : NULL;
+        app = launch_app(pInfo, package);
+        hint = POWER_HINT_LAUNCH;
+    }
+#endif
+
+    ret = check_hint(pInfo, hint, &t);
+    if (ret < 0)
         return;
+    stats_hint_received(pInfo, hint, t);
+    // An interaction with a duration may outlast the running boost,
+    // vsync on/off transitions are never dropped
+    if (ret > 0 && !(hint == POWER_HINT_INTERACTION && data) &&
+            hint != POWER_HINT_VSYNC) {
+        stats_hint_rate_limited(pInfo, hint);
+        return;
+    }
 
     switch (hint) {
     case POWER_HINT_VSYNC:
-        ALOGI("dealing with POWER_HINT_VSYNC -> boosting CPU for 100ms");
-        if (data) {
-            pInfo->mTimeoutPoker->requestPmQosTimed("/dev/cpu_freq_min",
-                                                     pInfo->max_frequency,
-                                                     ms2ns(100));
-            pInfo->mTimeoutPoker->requestPmQosTimed("/dev/min_online_cpus",
-                                                     DEFAULT_MAX_ONLINE_CPUS,
-                                                     ms2ns(100));
-        }
+        // Boosts are not worth the power in low power mode, the governor
+        // checks it on every window
+        vsync_governor_set(pInfo, data != NULL);
         break;
     case POWER_HINT_INTERACTION:
-        ALOGI("dealing with POWER_HINT_INTERACTION -> boosting CPU for 100ms");
-        // Stutters observed during transition animations at lower frequencies
-        pInfo->mTimeoutPoker->requestPmQosTimed("/dev/cpu_freq_min",
-                                                 pInfo->max_frequency,
-                                                 ms2ns(100));
-        pInfo->mTimeoutPoker->requestPmQosTimed("/dev/min_online_cpus",
-                                                 DEFAULT_MIN_ONLINE_CPUS,
-                                                 ms2ns(100));
+        pthread_mutex_lock(&pInfo->interaction_lock);
+        ret = interaction_boost(pInfo, data ? *(int *)data : 0, t);
+        pthread_mutex_unlock(&pInfo->interaction_lock);
+        if (!ret) {
+            stats_hint_rate_limited(pInfo, hint);
+            return;
+        }
         break;
-    case POWER_HINT_LAUNCH:
-        ALOGI("dealing with POWER_HINT_LAUNCH -> boosting CPU for 2 seconds");
-        pInfo->mTimeoutPoker->requestPmQosTimed("/dev/cpu_freq_min",
-                                                 pInfo->max_frequency,
-                                                 s2ns(2));
-        pInfo->mTimeoutPoker->requestPmQosTimed("/dev/min_online_cpus",
-                                                 DEFAULT_MAX_ONLINE_CPUS,
-                                                 s2ns(2));
-	break;
 #ifdef ANDROID_API_LP_OR_LATER
-	case POWER_HINT_LOW_POWER:
-		break;
+    case POWER_HINT_LOW_POWER:
+        // The framework passes data only when enabling
+        set_low_power(pInfo, data && *(int *)data);
+        break;
+    case POWER_HINT_SUSTAINED_PERFORMANCE:
+        sustained_mode_set(pInfo, data && *(int *)data);
+        break;
 #endif
+    case POWER_HINT_LAUNCH:
+        launch_boost(pInfo, app, package);
+        break;
     default:
-        ALOGE("Unknown power hint: 0x%x", hint);
+        if (pInfo->profiles[hint].duration_ms)
+            apply_hint_profile(pInfo, &pInfo->profiles[hint]);
+        else
+            ALOGE("Unknown power hint: 0x%x", hint);
         break;
     }
 
+    stats_hint_applied(pInfo, hint);
     pInfo->hint_time[hint] = t;
 }
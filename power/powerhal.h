@@ -26,6 +26,8 @@
 #include <semaphore.h>
 #include <stdlib.h>
 
+#include <atomic>
+
 #define MAX_CHARS 32
 #define MAX_INPUT_DEV_COUNT 12
 #define MAX_USE_CASE_STRING_SIZE 80
@@ -36,6 +38,106 @@
 #define DEFAULT_MAX_ONLINE_CPUS     4
 #define DEFAULT_FREQ                700
 
+#define POWER_PROFILES_PATH "/vendor/etc/power_profiles.conf"
+
+/* Per-application limits keyed on the launched package, see
+ * power_app_profiles.conf. The hash table is a power of two kept well
+ * above APP_PROFILE_MAX so probe sequences stay short.
+ */
+#define APP_PROFILES_PATH           "/vendor/etc/power_app_profiles.conf"
+#define APP_PROFILE_MAX             96
+#define APP_PROFILE_BUCKETS         128
+#define APP_PACKAGE_MAX             96
+#define APP_QOS_PRIORITY            5
+
+/* Launch boosts sized from the busy time of past launches of the same
+ * package, see powerhal_launch.cpp. Durations in ms.
+ */
+#define LAUNCH_HISTORY_PATH         "/data/system/powerhal_launches.txt"
+#define LAUNCH_HISTORY_MAX          64
+#define LAUNCH_HISTORY_BUCKETS      128
+#define LAUNCH_SAMPLE_MS            100
+#define LAUNCH_BUSY_PERCENT         50
+#define LAUNCH_QUIET_SAMPLES        3
+#define LAUNCH_MIN_MS               400
+#define LAUNCH_MAX_MS               5000
+#define LAUNCH_MARGIN_MS            200
+
+/* Interactions expected to last this long are boosted as flings */
+#define INTERACTION_FLING_MS        300
+#define INTERACTION_MAX_MS          3000
+
+/* Boost straight from touch events, see powerhal_input.cpp */
+#define INPUT_BOOST_PROP            "persist.power.input_boost"
+/* Events closer than this belong to the same gesture */
+#define INPUT_GESTURE_GAP_US        100000
+
+/* Limits held while POWER_HINT_LOW_POWER is on, the cpu frequency is
+ * capped at animation_boost_frequency.
+ */
+#define LOW_POWER_MAX_ONLINE_CPUS   2
+#define LOW_POWER_GPU_MAX_FREQ      247000
+#define LOW_POWER_QOS_PRIORITY      10
+
+/* Hint counters and PM QoS residency, written when the screen goes off */
+#define POWER_STATS_PATH            "/data/system/powerhal_stats.txt"
+#define STATS_GAP_BUCKETS           16
+
+/* The boot boost is released on sys.boot_completed, polled at
+ * BOOT_BOOST_POLL_MS, and at the latest after BOOT_BOOST_MAX_S.
+ */
+#define BOOT_BOOST_MAX_S            60
+#define BOOT_BOOST_POLL_MS          250
+
+/* TimeoutPoker categories of the boosts, cancelled on screen off */
+#define BOOST_CATEGORY_HINT         (1 << 0)
+#define BOOST_CATEGORY_WAKE         (1 << 1)
+#define BOOST_CATEGORY_BOOT         (1 << 2)
+/* Renewed every VSYNC window while frames are drawn */
+#define BOOST_CATEGORY_VSYNC        (1 << 3)
+/* The sustained performance task, resumed on screen on */
+#define BOOST_CATEGORY_SUSTAINED    (1 << 4)
+#define BOOST_CATEGORY_ALL          (BOOST_CATEGORY_HINT | BOOST_CATEGORY_WAKE | \
+                                     BOOST_CATEGORY_BOOT | BOOST_CATEGORY_VSYNC | \
+                                     BOOST_CATEGORY_SUSTAINED)
+
+/* VSYNC governor, see powerhal_vsync.cpp */
+#define VSYNC_MISS_NODE_PROP        "persist.power.vsync_miss_node"
+#define VSYNC_LEVELS                4
+#define VSYNC_WINDOW_MS             250
+#define VSYNC_PERIOD_US             16667
+#define VSYNC_MISS_TARGET_PERMILLE  20
+#define VSYNC_QUIET_WINDOWS         4
+#define VSYNC_BUSY_HIGH             85
+#define VSYNC_BUSY_LOW              50
+
+/* cpuquiet tuner, see powerhal_cpuquiet.cpp */
+#define CPUQUIET_TUNER_PROP         "persist.power.cpuquiet_tuner"
+#define CPUQUIET_SAMPLE_MS          2000
+#define CPUQUIET_SAMPLE_OFF_MS      10000
+#define CPUQUIET_BUSY_IDLE          10
+#define CPUQUIET_BUSY_AUDIO         30
+#define CPUQUIET_BUSY_SUSTAINED     70
+#define CPUQUIET_LP_SHARE_AUDIO     90
+#define CPUQUIET_SUSTAINED_SAMPLES  3
+
+/* Thermal boost ceiling, see powerhal_thermal.cpp. Headroom to the
+ * closest passive trip point in millidegrees.
+ */
+#define THERMAL_SAMPLE_MS           1000
+#define THERMAL_SAMPLE_OFF_MS       5000
+#define THERMAL_HEADROOM_HIGH       10000
+#define THERMAL_HEADROOM_LOW        4000
+#define THERMAL_HYSTERESIS          2000
+#define THERMAL_QOS_PRIORITY        20
+
+/* Sustained performance mode, see powerhal_sustained.cpp */
+#define SUSTAINED_PROP              "persist.power.sustained"
+#define SUSTAINED_CACHE_PATH        "/data/system/powerhal_sustained.txt"
+#define SUSTAINED_SAMPLE_MS         1000
+#define SUSTAINED_STABLE_S          300
+#define SUSTAINED_QOS_PRIORITY      30
+
 #define POWER_CAP_PROP "persist.sys.NV_PBC_PWR_LIMIT"
 #define SLEEP_INTERVAL_SECS 1
 
@@ -44,9 +146,55 @@ struct input_dev_map {
     const char* dev_name;
 };
 
+/* What a hint boosts, see power_profiles.conf */
+struct hint_profile {
+    /* cpu_freq_min floor in kHz, 0 for none */
+    int freq;
+    /* min_online_cpus floor, 0 for none */
+    int min_cpus;
+    int duration_ms;
+    /* gpu_freq_min floor and gpu_freq_max ceiling in kHz, 0 for none */
+    int gpu_min;
+    int gpu_max;
+};
+
+/* What the app in front gets, see power_app_profiles.conf */
+struct app_profile {
+    char package[APP_PACKAGE_MAX];
+    uint32_t hash;
+    /* Launch boost floor in kHz, 0 for the launch profile's */
+    int launch_freq;
+    /* Held until the next launch, 0 for none */
+    int min_cpus;
+    int max_cpus;
+    int max_freq;
+    int gpu_min;
+};
+
+/* Moving average of the busy time of a package's launches */
+struct launch_entry {
+    char package[APP_PACKAGE_MAX];
+    uint32_t hash;
+    int duration_ms;
+};
+
+/* Updated lock-free from the hint path */
+struct hint_stats {
+    std::atomic<uint32_t> received;
+    std::atomic<uint32_t> rate_limited;
+    std::atomic<uint32_t> applied;
+    std::atomic<uint64_t> last_us;
+    std::atomic<uint32_t> gaps[STATS_GAP_BUCKETS];
+};
+
 struct powerhal_info {
+    /* Created on first use, see get_timeout_poker() */
     TimeoutPoker* mTimeoutPoker;
 
+    /* common_power_open() and common_power_init() done */
+    bool opened;
+    bool initialized;
+
     int *available_frequencies;
     int num_available_frequencies;
 
@@ -71,6 +219,14 @@ struct powerhal_info {
     uint64_t hint_time[MAX_POWER_HINT_COUNT];
     uint64_t hint_interval[MAX_POWER_HINT_COUNT];
 
+    /* Boost applied per hint, indexed like hint_time */
+    struct hint_profile profiles[MAX_POWER_HINT_COUNT];
+
+    /* End (usec) and frequency of the running interaction boost */
+    uint64_t interaction_end;
+    int interaction_freq;
+    pthread_mutex_t interaction_lock;
+
     /* waiting condvar regular hints thread */
     pthread_cond_t wait_cond;
 
@@ -83,6 +239,66 @@ struct powerhal_info {
     /* regular hints thread handle */
     bool exit_hints_thread;
 
+    struct hint_stats stats[MAX_POWER_HINT_COUNT];
+
+    /* VSYNC governor state, only touched by its task but for the flags */
+    struct {
+        std::atomic<bool> active;
+        std::atomic<bool> running;
+        bool started;
+        int level;
+        int quiet_windows;
+        char miss_node[PROPERTY_VALUE_MAX];
+        uint64_t last_misses;
+        struct cpu_times last_times;
+    } vsync;
+
+    /* Boost ceiling set by the thermal sampler, 0 for none */
+    std::atomic<int> thermal_max_frequency;
+    /* Distance to the closest throttling trip point in millidegrees */
+    std::atomic<int> thermal_headroom;
+    /* Zones sampled for thermal_headroom, set before the sampler starts */
+    int thermal_zones;
+
+    /* Sustained performance mode, boosts are suppressed while active */
+    struct {
+        std::atomic<bool> active;
+        std::atomic<bool> running;
+    } sustained;
+
+    /* Last state passed to set_interactive */
+    bool interactive;
+
+    /* App profiles, open addressed on the package name hash */
+    struct {
+        pthread_mutex_t lock;
+        struct app_profile *table;
+        int count;
+        /* Profile of the last launched package, NULL for none */
+        const struct app_profile *current;
+    } apps;
+
+    /* Launch durations, open addressed like apps and loaded on first use */
+    struct {
+        pthread_mutex_t lock;
+        struct launch_entry *table;
+        int count;
+        bool dirty;
+        /* Bumped per launch, a tracker only records its own launch */
+        std::atomic<uint32_t> seq;
+    } launches;
+
+    /* Low power (battery saver) mode */
+    struct {
+        pthread_mutex_t lock;
+        bool enabled;
+        int max_frequency;
+        /* PM QoS handles holding the ceilings */
+        int cpu_freq_fd;
+        int online_cpus_fd;
+        int gpu_freq_fd;
+    } low_power;
+
     /* Features on platform */
     struct {
         bool fan;
@@ -90,14 +306,20 @@ struct powerhal_info {
 
     /* File descriptors used for hints and app profiles */
     struct {
-        int interactive_max_cpus;
+        int app_min_cpus;
+        int app_max_cpus;
+        int app_max_freq;
+        int app_gpu_min;
     } fds;
 
 };
 
-/* Opens power hw module */
+/* Opens power hw module, only the first call does anything */
 void common_power_open(struct powerhal_info *pInfo);
 
+/* Returns the TimeoutPoker, starting its thread on the first call */
+TimeoutPoker* get_timeout_poker(struct powerhal_info *pInfo);
+
 /* Power management setup action at startup.
  * Such as to set default cpufreq parameters.
  */
@@ -119,5 +341,59 @@ void common_power_set_interactive(struct power_module *module,
 void common_power_hint(struct power_module *module, struct powerhal_info *pInfo,
                             power_hint_t hint, void *data);
 
-#endif  //COMMON_POWER_HAL_H
+/* Interaction boost for a touch seen by the input monitor, framework
+ * interaction hints arriving right after it are rate limited.
+ */
+void common_power_touch_boost(struct powerhal_info *pInfo, uint64_t now);
+
+/* Starts the input monitor when INPUT_BOOST_PROP is set */
+void start_input_monitor(struct powerhal_info *pInfo);
+
+/* Frame feedback driven VSYNC boost, see powerhal_vsync.cpp */
+void vsync_governor_init(struct powerhal_info *pInfo);
+void vsync_governor_set(struct powerhal_info *pInfo, bool on);
+
+/* Workload driven cpuquiet tuning, unless CPUQUIET_TUNER_PROP is off */
+void start_cpuquiet_tuner(struct powerhal_info *pInfo);
+
+/* Scales a boost down to what low power mode and the thermal ceiling allow */
+void cap_boost(struct powerhal_info *pInfo, int *freq, int *min_cpus);
+
+/* Caps boosts as the SoC nears its throttling trip points */
+void start_thermal_sampler(struct powerhal_info *pInfo);
+
+/* Enters or leaves sustained performance mode */
+void sustained_mode_set(struct powerhal_info *pInfo, bool on);
+
+/* Hint telemetry, see powerhal_stats.cpp */
+void stats_hint_received(struct powerhal_info *pInfo, power_hint_t hint, uint64_t now);
+void stats_hint_rate_limited(struct powerhal_info *pInfo, power_hint_t hint);
+void stats_hint_applied(struct powerhal_info *pInfo, power_hint_t hint);
+/* Queues the write of the stats to POWER_STATS_PATH, does not block */
+void common_power_dump_stats(struct powerhal_info *pInfo);
 
+/* Fills profiles and hint_interval from POWER_PROFILES_PATH, falling
+ * back to built-in values. Needs the frequency table of common_power_open.
+ */
+void load_hint_profiles(struct powerhal_info *pInfo);
+
+/* Fills the app profile table from APP_PROFILES_PATH, if present */
+void load_app_profiles(struct powerhal_info *pInfo);
+
+/* Hash of the package names in the app and launch tables */
+uint32_t package_hash(const char *package);
+
+/* Profile of package, NULL when it has none */
+const struct app_profile *find_app_profile(struct powerhal_info *pInfo,
+        const char *package);
+
+/* Learned launch boost of package in ms, 0 when unknown */
+int launch_boost_duration(struct powerhal_info *pInfo, const char *package);
+/* Measures the launch of package that was just boosted */
+void launch_tracker_start(struct powerhal_info *pInfo, const char *package);
+/* Drops the running measurement */
+void launch_tracker_stop(struct powerhal_info *pInfo);
+/* Writes the launch durations back from the poker thread, if they changed */
+void launch_history_save(struct powerhal_info *pInfo);
+
+#endif  //COMMON_POWER_HAL_H
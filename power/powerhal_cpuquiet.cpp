@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "powerHAL::cpuquiet"
+
+#include <stdio.h>
+
+#include "powerhal.h"
+
+#define BALANCED_PATH "/sys/devices/system/cpu/cpuquiet/balanced/"
+#define TIME_IN_STATE_PATH "/sys/devices/system/cpu/cpu0/cpufreq/stats/time_in_state"
+
+/*
+ * Adapts the balanced cpuquiet governor to the workload. Every sample
+ * classifies the last interval from /proc/stat and time_in_state:
+ *
+ *   idle         almost no load
+ *   audio        light steady load that the LP cluster can carry
+ *   interactive  anything in between, the init.grouper.rc tuning
+ *   sustained    heavy load for several samples in a row
+ *
+ * A class has to be seen twice in a row before its tuning is written.
+ * Nothing is changed while a boost is held, the boost owns the cpus.
+ */
+enum {
+    WORKLOAD_IDLE,
+    WORKLOAD_AUDIO,
+    WORKLOAD_INTERACTIVE,
+    WORKLOAD_SUSTAINED,
+    WORKLOAD_COUNT
+};
+
+static const struct {
+    const char *name;
+    int up_delay;
+    int down_delay;
+    int idle_top_freq;
+    int idle_bottom_freq;
+} tunings[WORKLOAD_COUNT] = {
+    /* Stay on the LP core, come back down quickly */
+    { "idle",        200,  30, 620000, 102000 },
+    { "audio",       150,  30, 620000, 204000 },
+    { "interactive",  60,  60, 620000, 102000 },
+    /* Bring cores up early and keep them */
+    { "sustained",    30, 500, 475000, 102000 },
+};
+
+class CpuquietTuner : public TimeoutPoker::Task {
+public:
+    CpuquietTuner(struct powerhal_info *pInfo) :
+        mInfo(pInfo),
+        mApplied(-1),
+        mCandidate(-1),
+        mBusySamples(0),
+        mLastLp(0),
+        mLastTotal(0) {
+        memset(&mLastTimes, 0, sizeof(mLastTimes));
+    }
+
+    virtual nsecs_t run(nsecs_t now);
+
+private:
+    int classify();
+    bool readTimeInState(uint64_t *lp, uint64_t *total);
+    void apply(int workload);
+
+    struct powerhal_info *mInfo;
+    int mApplied;
+    int mCandidate;
+    int mBusySamples;
+    struct cpu_times mLastTimes;
+    uint64_t mLastLp;
+    uint64_t mLastTotal;
+};
+
+/* Time spent at frequencies the LP cluster can run, in 10 ms units */
+bool CpuquietTuner::readTimeInState(uint64_t *lp, uint64_t *total)
+{
+    char buf[512];
+    char *line;
+    char *save;
+
+    memset(buf, 0, sizeof(buf));
+    sysfs_read(TIME_IN_STATE_PATH, buf, sizeof(buf) - 1);
+
+    *lp = 0;
+    *total = 0;
+    for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        unsigned long freq;
+        unsigned long long t;
+
+        if (sscanf(line, "%lu %llu", &freq, &t) != 2)
+            continue;
+        *total += t;
+        if ((int)freq <= mInfo->lp_max_frequency)
+            *lp += t;
+    }
+
+    return *total != 0;
+}
+
+int CpuquietTuner::classify()
+{
+    struct cpu_times times;
+    uint64_t lp, total;
+    int busy;
+    int lp_share = 100;
+
+    if (!read_cpu_times(&times))
+        return -1;
+    busy = cpu_busy_percent(&mLastTimes, &times);
+    mLastTimes = times;
+
+    if (readTimeInState(&lp, &total)) {
+        if (mLastTotal && total > mLastTotal)
+            lp_share = (int)((lp - mLastLp) * 100 / (total - mLastTotal));
+        mLastLp = lp;
+        mLastTotal = total;
+    }
+
+    mBusySamples = busy >= CPUQUIET_BUSY_SUSTAINED ? mBusySamples + 1 : 0;
+    if (mBusySamples >= CPUQUIET_SUSTAINED_SAMPLES)
+        return WORKLOAD_SUSTAINED;
+    if (busy < CPUQUIET_BUSY_IDLE)
+        return WORKLOAD_IDLE;
+    if (busy < CPUQUIET_BUSY_AUDIO && lp_share >= CPUQUIET_LP_SHARE_AUDIO)
+        return WORKLOAD_AUDIO;
+    return WORKLOAD_INTERACTIVE;
+}
+
+void CpuquietTuner::apply(int workload)
+{
+    sysfs_write_int(BALANCED_PATH "up_delay", tunings[workload].up_delay);
+    sysfs_write_int(BALANCED_PATH "down_delay", tunings[workload].down_delay);
+    sysfs_write_int(BALANCED_PATH "idle_top_freq", tunings[workload].idle_top_freq);
+    sysfs_write_int(BALANCED_PATH "idle_bottom_freq", tunings[workload].idle_bottom_freq);
+    mApplied = workload;
+    ALOGV("cpuquiet tuned for %s workload", tunings[workload].name);
+}
+
+nsecs_t CpuquietTuner::run(__attribute__ ((unused)) nsecs_t now)
+{
+    // Runs on the poker thread, where boost state can be read directly.
+    // The VSYNC governor holds its requests for as long as frames are
+    // drawn, which is most of the time the tuner matters.
+    bool boosted = get_timeout_poker(mInfo)->hasActiveRequests(
+            BOOST_CATEGORY_ALL & ~BOOST_CATEGORY_VSYNC);
+    nsecs_t next = ms2ns(mInfo->interactive ? CPUQUIET_SAMPLE_MS : CPUQUIET_SAMPLE_OFF_MS);
+    int workload = classify();
+
+    if (workload < 0 || boosted) {
+        mCandidate = -1;
+        return next;
+    }
+
+    if (workload != mCandidate) {
+        mCandidate = workload;
+        return next;
+    }
+
+    if (workload != mApplied)
+        apply(workload);
+
+    return next;
+}
+
+void start_cpuquiet_tuner(struct powerhal_info *pInfo)
+{
+    if (!get_property_bool(CPUQUIET_TUNER_PROP, true))
+        return;
+
+    get_timeout_poker(pInfo)->postTask(new CpuquietTuner(pInfo), ms2ns(CPUQUIET_SAMPLE_MS));
+}
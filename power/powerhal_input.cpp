@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "powerHAL::input"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <linux/input.h>
+
+#include "powerhal.h"
+
+#define INPUT_EVENT_BATCH 64
+
+struct input_monitor {
+    struct powerhal_info *pInfo;
+    int epoll_fd;
+    uint64_t last_event_us;
+};
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Finds the evdev node of /sys/class/input/input<dev_id> */
+static int open_event_node(int dev_id)
+{
+    char path[80];
+    char buf[POWERHAL_PATH_MAX];
+    struct dirent *de;
+    DIR *dir;
+    int fd = -1;
+
+    snprintf(path, sizeof(path), "/sys/class/input/input%d", dev_id);
+    dir = opendir(powerhal_path(path, buf, sizeof(buf)));
+    if (!dir)
+        return -1;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (strncmp(de->d_name, "event", 5))
+            continue;
+        snprintf(path, sizeof(path), "/dev/input/%s", de->d_name);
+        fd = powerhal_open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+            ALOGE("Error opening %s: %s", path, strerror(errno));
+        break;
+    }
+
+    closedir(dir);
+    return fd;
+}
+
+static void handle_events(struct input_monitor *mon, int fd)
+{
+    struct input_event events[INPUT_EVENT_BATCH];
+    bool abs_seen = false;
+    uint64_t now;
+    ssize_t len;
+
+    while ((len = read(fd, events, sizeof(events))) > 0) {
+        for (size_t i = 0; i < len / sizeof(events[0]); i++) {
+            if (events[i].type == EV_ABS)
+                abs_seen = true;
+        }
+    }
+
+    // The device went away (ENODEV on unplug), it would stay readable
+    // in the level-triggered set and spin the loop.
+    if (len < 0 && errno != EAGAIN && errno != EINTR) {
+        ALOGW("Input device dropped: %s", strerror(errno));
+        epoll_ctl(mon->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+    }
+
+    if (!abs_seen)
+        return;
+
+    // Only the first contact of a gesture boosts, the framework hints
+    // cover the rest of it.
+    now = now_us();
+    if (now - mon->last_event_us > INPUT_GESTURE_GAP_US)
+        common_power_touch_boost(mon->pInfo, now);
+    mon->last_event_us = now;
+}
+
+static void *input_monitor_loop(void *arg)
+{
+    struct input_monitor *mon = (struct input_monitor *)arg;
+    struct epoll_event events[MAX_INPUT_DEV_COUNT];
+    int n;
+
+    for (;;) {
+        n = epoll_wait(mon->epoll_fd, events, MAX_INPUT_DEV_COUNT, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+            handle_events(mon, events[i].data.fd);
+    }
+
+    return NULL;
+}
+
+void start_input_monitor(struct powerhal_info *pInfo)
+{
+    struct input_monitor *mon;
+    struct epoll_event ev;
+    pthread_t thread;
+    int count = 0;
+    int fd;
+
+    if (!get_property_bool(INPUT_BOOST_PROP, false) || !pInfo->input_devs)
+        return;
+
+    mon = (struct input_monitor *)calloc(1, sizeof(*mon));
+    if (!mon)
+        return;
+    mon->pInfo = pInfo;
+    mon->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (mon->epoll_fd < 0) {
+        free(mon);
+        return;
+    }
+
+    for (int i = 0; i < pInfo->input_cnt; i++) {
+        if (-1 == pInfo->input_devs[i].dev_id)
+            continue;
+
+        fd = open_event_node(pInfo->input_devs[i].dev_id);
+        if (fd < 0)
+            continue;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(mon->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+            close(fd);
+            continue;
+        }
+        count++;
+    }
+
+    if (!count || pthread_create(&thread, NULL, input_monitor_loop, mon)) {
+        ALOGE("Input monitor not started");
+        close(mon->epoll_fd);
+        free(mon);
+        return;
+    }
+
+    pthread_detach(thread);
+    ALOGI("Input monitor watching %d touch devices", count);
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "powerHAL::launch"
+
+#include <stdio.h>
+
+#include "powerhal.h"
+
+/*
+ * Learns how long the launches of each package keep the cpus busy. After
+ * a launch boost a task samples /proc/stat every LAUNCH_SAMPLE_MS; the
+ * launch is over after LAUNCH_QUIET_SAMPLES samples in a row with the
+ * busiest cpu under LAUNCH_BUSY_PERCENT. Launches are mostly bound by
+ * the main thread, which only shows as a quarter of the aggregate load
+ * on four cpus. The busy time is folded into a per-package moving
+ * average, which sizes the next launch boost of that package.
+ *
+ * The history is read from LAUNCH_HISTORY_PATH on first use, /data may
+ * not be up when the HAL is opened, and written back on screen off from
+ * the poker thread, off the binder thread that turned the screen off.
+ */
+
+/* Slot holding package, or the empty slot where it would go */
+static struct launch_entry *launch_slot(struct launch_entry *table,
+        const char *package, uint32_t hash)
+{
+    uint32_t i = hash & (LAUNCH_HISTORY_BUCKETS - 1);
+
+    // Never full, at most LAUNCH_HISTORY_MAX entries are added
+    while (table[i].package[0] &&
+            (table[i].hash != hash || strcmp(table[i].package, package)))
+        i = (i + 1) & (LAUNCH_HISTORY_BUCKETS - 1);
+
+    return &table[i];
+}
+
+/* Entry of package, added if there is room. launches.lock held. */
+static struct launch_entry *launch_entry_get(struct powerhal_info *pInfo,
+        const char *package)
+{
+    uint32_t hash = package_hash(package);
+    struct launch_entry *e = launch_slot(pInfo->launches.table, package, hash);
+
+    if (e->package[0])
+        return e;
+    if (pInfo->launches.count >= LAUNCH_HISTORY_MAX)
+        return NULL;
+
+    snprintf(e->package, sizeof(e->package), "%s", package);
+    e->hash = hash;
+    e->duration_ms = 0;
+    pInfo->launches.count++;
+    return e;
+}
+
+/* launches.lock held */
+static bool launch_history_load(struct powerhal_info *pInfo)
+{
+    char package[APP_PACKAGE_MAX];
+    int duration_ms;
+    FILE *f;
+
+    if (pInfo->launches.table)
+        return true;
+
+    pInfo->launches.table = (struct launch_entry *)calloc(LAUNCH_HISTORY_BUCKETS,
+            sizeof(struct launch_entry));
+    if (!pInfo->launches.table)
+        return false;
+
+    f = powerhal_fopen(LAUNCH_HISTORY_PATH, "r");
+    if (!f)
+        return true;
+
+    while (fscanf(f, "%95s %d", package, &duration_ms) == 2) {
+        struct launch_entry *e;
+
+        if (duration_ms < LAUNCH_MIN_MS || duration_ms > LAUNCH_MAX_MS)
+            continue;
+        e = launch_entry_get(pInfo, package);
+        if (!e)
+            break;
+        e->duration_ms = duration_ms;
+    }
+
+    fclose(f);
+    ALOGI("Loaded %d launch durations", pInfo->launches.count);
+    return true;
+}
+
+int launch_boost_duration(struct powerhal_info *pInfo, const char *package)
+{
+    struct launch_entry *e;
+    int duration_ms = 0;
+
+    if (!package)
+        return 0;
+
+    pthread_mutex_lock(&pInfo->launches.lock);
+    if (launch_history_load(pInfo)) {
+        e = launch_slot(pInfo->launches.table, package, package_hash(package));
+        if (e->package[0] && e->duration_ms)
+            duration_ms = e->duration_ms + LAUNCH_MARGIN_MS;
+    }
+    pthread_mutex_unlock(&pInfo->launches.lock);
+
+    return duration_ms > LAUNCH_MAX_MS ? LAUNCH_MAX_MS : duration_ms;
+}
+
+static void launch_history_record(struct powerhal_info *pInfo, const char *package,
+        int busy_ms)
+{
+    struct launch_entry *e;
+
+    if (busy_ms < LAUNCH_MIN_MS)
+        busy_ms = LAUNCH_MIN_MS;
+
+    pthread_mutex_lock(&pInfo->launches.lock);
+    if (launch_history_load(pInfo) && (e = launch_entry_get(pInfo, package))) {
+        // Moving average weighing the new launch by a quarter
+        e->duration_ms = e->duration_ms ? (e->duration_ms * 3 + busy_ms) / 4 : busy_ms;
+        pInfo->launches.dirty = true;
+        ALOGV("%s launched in %d ms, boosting for %d ms", package, busy_ms,
+                e->duration_ms);
+    }
+    pthread_mutex_unlock(&pInfo->launches.lock);
+}
+
+class LaunchHistoryWriter : public TimeoutPoker::Task {
+public:
+    LaunchHistoryWriter(struct powerhal_info *pInfo) : mInfo(pInfo) {}
+    virtual nsecs_t run(nsecs_t now);
+
+private:
+    struct powerhal_info *mInfo;
+};
+
+nsecs_t LaunchHistoryWriter::run(__attribute__ ((unused)) nsecs_t now)
+{
+    struct powerhal_info *pInfo = mInfo;
+    FILE *f;
+
+    pthread_mutex_lock(&pInfo->launches.lock);
+    if (!pInfo->launches.dirty) {
+        pthread_mutex_unlock(&pInfo->launches.lock);
+        return 0;
+    }
+
+    f = powerhal_fopen(LAUNCH_HISTORY_PATH, "w");
+    if (!f) {
+        ALOGE("Error opening %s: %s", LAUNCH_HISTORY_PATH, strerror(errno));
+        pthread_mutex_unlock(&pInfo->launches.lock);
+        return 0;
+    }
+
+    for (int i = 0; i < LAUNCH_HISTORY_BUCKETS; i++) {
+        const struct launch_entry *e = &pInfo->launches.table[i];
+
+        if (e->package[0] && e->duration_ms)
+            fprintf(f, "%s %d\n", e->package, e->duration_ms);
+    }
+
+    fclose(f);
+    pInfo->launches.dirty = false;
+    pthread_mutex_unlock(&pInfo->launches.lock);
+    return 0;
+}
+
+void launch_history_save(struct powerhal_info *pInfo)
+{
+    get_timeout_poker(pInfo)->postTask(new LaunchHistoryWriter(pInfo), 0);
+}
+
+class LaunchTracker : public TimeoutPoker::Task {
+public:
+    LaunchTracker(struct powerhal_info *pInfo, const char *package, uint32_t seq) :
+        mInfo(pInfo),
+        mSeq(seq),
+        mStart(0),
+        mLastBusy(0),
+        mQuietSamples(0) {
+        snprintf(mPackage, sizeof(mPackage), "%s", package);
+        memset(mLastTimes, 0, sizeof(mLastTimes));
+    }
+
+    virtual nsecs_t run(nsecs_t now);
+
+private:
+    struct powerhal_info *mInfo;
+    char mPackage[APP_PACKAGE_MAX];
+    uint32_t mSeq;
+    nsecs_t mStart;
+    nsecs_t mLastBusy;
+    int mQuietSamples;
+    struct cpu_times mLastTimes[POWERHAL_MAX_CPUS];
+};
+
+nsecs_t LaunchTracker::run(nsecs_t now)
+{
+    struct cpu_times times[POWERHAL_MAX_CPUS];
+
+    // A newer launch or the screen going off ends the measurement
+    if (mInfo->launches.seq.load() != mSeq ||
+            !read_percpu_times(times, POWERHAL_MAX_CPUS))
+        return 0;
+
+    if (!mStart) {
+        mStart = now;
+        mLastBusy = now;
+        memcpy(mLastTimes, times, sizeof(mLastTimes));
+        return ms2ns(LAUNCH_SAMPLE_MS);
+    }
+
+    if (busiest_cpu_percent(mLastTimes, times, POWERHAL_MAX_CPUS) >= LAUNCH_BUSY_PERCENT) {
+        mLastBusy = now;
+        mQuietSamples = 0;
+    } else {
+        mQuietSamples++;
+    }
+    memcpy(mLastTimes, times, sizeof(mLastTimes));
+
+    if (mQuietSamples < LAUNCH_QUIET_SAMPLES && now - mStart < ms2ns(LAUNCH_MAX_MS))
+        return ms2ns(LAUNCH_SAMPLE_MS);
+
+    launch_history_record(mInfo, mPackage, (int)ns2ms(mLastBusy - mStart));
+    return 0;
+}
+
+void launch_tracker_start(struct powerhal_info *pInfo, const char *package)
+{
+    uint32_t seq = pInfo->launches.seq.fetch_add(1) + 1;
+
+    if (package)
+        get_timeout_poker(pInfo)->postTask(new LaunchTracker(pInfo, package, seq), 0);
+}
+
+void launch_tracker_stop(struct powerhal_info *pInfo)
+{
+    pInfo->launches.seq.fetch_add(1);
+}
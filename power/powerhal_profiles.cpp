@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "powerHAL::profiles"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "powerhal.h"
+
+#define PROFILE_LINE_MAX 128
+
+static const struct {
+    const char *name;
+    power_hint_t hint;
+} hint_names[] = {
+    { "vsync",          POWER_HINT_VSYNC },
+    { "interaction",    POWER_HINT_INTERACTION },
+    { "video_encode",   POWER_HINT_VIDEO_ENCODE },
+    { "video_decode",   POWER_HINT_VIDEO_DECODE },
+#ifdef ANDROID_API_LP_OR_LATER
+    { "low_power",      POWER_HINT_LOW_POWER },
+#endif
+    { "launch",         POWER_HINT_LAUNCH },
+};
+
+/* Built-in profiles, used for hints the file does not mention */
+static const struct {
+    power_hint_t hint;
+    const char *freq;
+    int min_cpus;
+    int duration_ms;
+    int rate_limit_ms;
+} default_profiles[] = {
+    { POWER_HINT_VSYNC,       "max", DEFAULT_MAX_ONLINE_CPUS, 100,  100 },
+    { POWER_HINT_INTERACTION, "max", DEFAULT_MIN_ONLINE_CPUS, 100,  100 },
+    { POWER_HINT_LAUNCH,      "max", DEFAULT_MAX_ONLINE_CPUS, 2000, 2000 },
+};
+
+static int parse_hint(const char *name)
+{
+    for (size_t i = 0; i < sizeof(hint_names) / sizeof(hint_names[0]); i++) {
+        if (!strcmp(name, hint_names[i].name))
+            return hint_names[i].hint;
+    }
+
+    return -1;
+}
+
+/* Resolves a frequency keyword or kHz value to an available frequency */
+static int parse_freq(struct powerhal_info *pInfo, const char *s)
+{
+    int freq;
+    int i;
+
+    if (!strcmp(s, "max"))
+        return pInfo->max_frequency;
+    if (!strcmp(s, "interaction"))
+        return pInfo->interaction_boost_frequency;
+    if (!strcmp(s, "animation"))
+        return pInfo->animation_boost_frequency;
+    if (!strcmp(s, "lp_max"))
+        return pInfo->lp_max_frequency;
+
+    freq = atoi(s);
+    if (freq <= 0)
+        return 0;
+
+    for (i = 0; i < pInfo->num_available_frequencies; i++) {
+        if (pInfo->available_frequencies[i] >= freq)
+            return pInfo->available_frequencies[i];
+    }
+
+    return pInfo->max_frequency;
+}
+
+static void set_profile(struct powerhal_info *pInfo, int hint, int freq,
+        int min_cpus, int duration_ms, int rate_limit_ms, int gpu_min, int gpu_max)
+{
+    struct hint_profile *p = &pInfo->profiles[hint];
+
+    p->freq = freq;
+    p->min_cpus = min_cpus > DEFAULT_MAX_ONLINE_CPUS ? DEFAULT_MAX_ONLINE_CPUS : min_cpus;
+    p->duration_ms = duration_ms;
+    p->gpu_min = gpu_min;
+    p->gpu_max = gpu_max;
+    pInfo->hint_interval[hint] = (uint64_t)rate_limit_ms * 1000;
+}
+
+void load_hint_profiles(struct powerhal_info *pInfo)
+{
+    char line[PROFILE_LINE_MAX];
+    char name[32];
+    char freq[16];
+    int min_cpus, duration_ms, rate_limit_ms, gpu_min, gpu_max;
+    bool has_gpu_min = !powerhal_access("/dev/gpu_freq_min", W_OK);
+    bool has_gpu_max = !powerhal_access("/dev/gpu_freq_max", W_OK);
+    int lineno = 0;
+    int loaded = 0;
+    FILE *f;
+
+    for (size_t i = 0; i < sizeof(default_profiles) / sizeof(default_profiles[0]); i++) {
+        set_profile(pInfo, default_profiles[i].hint,
+                parse_freq(pInfo, default_profiles[i].freq),
+                default_profiles[i].min_cpus,
+                default_profiles[i].duration_ms,
+                default_profiles[i].rate_limit_ms, 0, 0);
+    }
+
+    f = powerhal_fopen(POWER_PROFILES_PATH, "r");
+    if (!f) {
+        ALOGI("No %s, using built-in profiles", POWER_PROFILES_PATH);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char *s = line;
+        int hint;
+
+        lineno++;
+        while (*s == ' ' || *s == '\t')
+            s++;
+        if (*s == '#' || *s == '\n' || *s == '\0')
+            continue;
+
+        // The gpu columns are optional
+        gpu_min = gpu_max = 0;
+        if (sscanf(s, "%31s %15s %d %d %d %d %d", name, freq, &min_cpus,
+                    &duration_ms, &rate_limit_ms, &gpu_min, &gpu_max) < 5 ||
+                min_cpus < 0 || duration_ms < 0 || rate_limit_ms < 0 ||
+                gpu_min < 0 || gpu_max < 0) {
+            ALOGE("%s:%d: malformed profile", POWER_PROFILES_PATH, lineno);
+            continue;
+        }
+
+        hint = parse_hint(name);
+        if (hint < 0 || hint >= MAX_POWER_HINT_COUNT) {
+            ALOGE("%s:%d: unknown hint %s", POWER_PROFILES_PATH, lineno, name);
+            continue;
+        }
+
+        if ((gpu_min && !has_gpu_min) || (gpu_max && !has_gpu_max)) {
+            ALOGW("%s:%d: no gpu PM QoS nodes, gpu limits ignored",
+                    POWER_PROFILES_PATH, lineno);
+            gpu_min = has_gpu_min ? gpu_min : 0;
+            gpu_max = has_gpu_max ? gpu_max : 0;
+        }
+
+        set_profile(pInfo, hint, parse_freq(pInfo, freq), min_cpus,
+                duration_ms, rate_limit_ms, gpu_min, gpu_max);
+        loaded++;
+    }
+
+    fclose(f);
+    ALOGI("Loaded %d profiles from %s", loaded, POWER_PROFILES_PATH);
+}
+
+/* FNV-1a, package names are short and mostly share their prefixes */
+uint32_t package_hash(const char *package)
+{
+    uint32_t h = 2166136261u;
+
+    while (*package) {
+        h ^= (uint8_t)*package++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/* Slot holding package, or the empty slot where it would go */
+static struct app_profile *app_slot(struct app_profile *table,
+        const char *package, uint32_t hash)
+{
+    uint32_t i = hash & (APP_PROFILE_BUCKETS - 1);
+
+    // Never full, load_app_profiles stops at APP_PROFILE_MAX
+    while (table[i].package[0] &&
+            (table[i].hash != hash || strcmp(table[i].package, package)))
+        i = (i + 1) & (APP_PROFILE_BUCKETS - 1);
+
+    return &table[i];
+}
+
+const struct app_profile *find_app_profile(struct powerhal_info *pInfo,
+        const char *package)
+{
+    struct app_profile *app;
+
+    if (!pInfo->apps.table || !package)
+        return NULL;
+
+    app = app_slot(pInfo->apps.table, package, package_hash(package));
+    return app->package[0] ? app : NULL;
+}
+
+void load_app_profiles(struct powerhal_info *pInfo)
+{
+    char line[PROFILE_LINE_MAX];
+    char package[APP_PACKAGE_MAX];
+    char launch_freq[16];
+    char max_freq[16];
+    int min_cpus, max_cpus, gpu_min;
+    int lineno = 0;
+    FILE *f;
+
+    f = powerhal_fopen(APP_PROFILES_PATH, "r");
+    if (!f)
+        return;
+
+    pInfo->apps.table = (struct app_profile *)calloc(APP_PROFILE_BUCKETS,
+            sizeof(struct app_profile));
+    if (!pInfo->apps.table) {
+        fclose(f);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        struct app_profile *app;
+        char *s = line;
+        uint32_t hash;
+
+        lineno++;
+        while (*s == ' ' || *s == '\t')
+            s++;
+        if (*s == '#' || *s == '\n' || *s == '\0')
+            continue;
+
+        if (sscanf(s, "%95s %15s %d %d %15s %d", package, launch_freq,
+                    &min_cpus, &max_cpus, max_freq, &gpu_min) != 6 ||
+                min_cpus < 0 || max_cpus < 0 || gpu_min < 0 ||
+                (max_cpus && min_cpus > max_cpus)) {
+            ALOGE("%s:%d: malformed app profile", APP_PROFILES_PATH, lineno);
+            continue;
+        }
+
+        if (pInfo->apps.count >= APP_PROFILE_MAX) {
+            ALOGE("%s:%d: more than %d app profiles", APP_PROFILES_PATH,
+                    lineno, APP_PROFILE_MAX);
+            break;
+        }
+
+        hash = package_hash(package);
+        app = app_slot(pInfo->apps.table, package, hash);
+        if (app->package[0])
+            ALOGW("%s:%d: %s listed twice", APP_PROFILES_PATH, lineno, package);
+        else
+            pInfo->apps.count++;
+
+        snprintf(app->package, sizeof(app->package), "%s", package);
+        app->hash = hash;
+        app->launch_freq = parse_freq(pInfo, launch_freq);
+        app->min_cpus = min_cpus > DEFAULT_MAX_ONLINE_CPUS ? DEFAULT_MAX_ONLINE_CPUS : min_cpus;
+        app->max_cpus = max_cpus > DEFAULT_MAX_ONLINE_CPUS ? 0 : max_cpus;
+        app->max_freq = parse_freq(pInfo, max_freq);
+        app->gpu_min = !powerhal_access("/dev/gpu_freq_min", W_OK) ? gpu_min : 0;
+    }
+
+    fclose(f);
+    ALOGI("Loaded %d app profiles from %s", pInfo->apps.count, APP_PROFILES_PATH);
+}
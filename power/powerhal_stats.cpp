@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "powerHAL::stats"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "powerhal.h"
+
+static void count(std::atomic<uint32_t> *counter)
+{
+    counter->fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Bucket i holds gaps in [2^i, 2^(i+1)) ms, the last one everything above */
+static int gap_bucket(uint64_t gap_us)
+{
+    uint64_t gap_ms = gap_us / 1000;
+    int bucket = 0;
+
+    while (gap_ms > 1 && bucket < STATS_GAP_BUCKETS - 1) {
+        gap_ms >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+void stats_hint_received(struct powerhal_info *pInfo, power_hint_t hint, uint64_t now)
+{
+    struct hint_stats *st = &pInfo->stats[hint];
+    uint64_t last = st->last_us.exchange(now, std::memory_order_relaxed);
+
+    count(&st->received);
+    if (last && now > last)
+        count(&st->gaps[gap_bucket(now - last)]);
+}
+
+void stats_hint_rate_limited(struct powerhal_info *pInfo, power_hint_t hint)
+{
+    count(&pInfo->stats[hint].rate_limited);
+}
+
+void stats_hint_applied(struct powerhal_info *pInfo, power_hint_t hint)
+{
+    count(&pInfo->stats[hint].applied);
+}
+
+/*
+ * Written from the poker thread: set_interactive runs on a binder thread
+ * and must not wait for the poker nor for /data.
+ */
+class StatsWriter : public TimeoutPoker::Task {
+public:
+    StatsWriter(struct powerhal_info *pInfo) : mInfo(pInfo) {}
+    virtual nsecs_t run(nsecs_t now);
+
+private:
+    struct powerhal_info *mInfo;
+};
+
+nsecs_t StatsWriter::run(nsecs_t now)
+{
+    int fd;
+    int i, j;
+
+    fd = powerhal_open(POWER_STATS_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        ALOGE("Error opening %s: %s", POWER_STATS_PATH, strerror(errno));
+        return 0;
+    }
+
+    dprintf(fd, "uptime %lld ms\n", (long long)ns2ms(now));
+    dprintf(fd, "hint: received rate_limited applied | gaps (ms, log2 buckets)\n");
+    for (i = 0; i < MAX_POWER_HINT_COUNT; i++) {
+        struct hint_stats *st = &mInfo->stats[i];
+        uint32_t received = st->received.load(std::memory_order_relaxed);
+
+        if (!received)
+            continue;
+
+        dprintf(fd, "  0x%x: %u %u %u |", i, received,
+                st->rate_limited.load(std::memory_order_relaxed),
+                st->applied.load(std::memory_order_relaxed));
+        for (j = 0; j < STATS_GAP_BUCKETS; j++)
+            dprintf(fd, " %u", st->gaps[j].load(std::memory_order_relaxed));
+        dprintf(fd, "\n");
+    }
+
+    get_timeout_poker(mInfo)->dumpFromTask(fd);
+    close(fd);
+    return 0;
+}
+
+void common_power_dump_stats(struct powerhal_info *pInfo)
+{
+    get_timeout_poker(pInfo)->postTask(new StatsWriter(pInfo), 0);
+}
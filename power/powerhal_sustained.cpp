@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "powerHAL::sustained"
+
+#include <stdio.h>
+
+#include "powerhal.h"
+
+/*
+ * Sustained performance mode pins the cpu frequency floor and ceiling
+ * and the online cpu count to a level the device can hold at its
+ * thermal limit, instead of boosting in spikes.
+ *
+ * Until that level is known it is calibrated online: starting from the
+ * top, the level steps down whenever the thermal headroom falls under
+ * THERMAL_HEADROOM_LOW. A level held for SUSTAINED_STABLE_S without
+ * that is stored in SUSTAINED_CACHE_PATH and used from then on. The
+ * headroom is still watched once calibrated, the thermal sampler leaves
+ * the ceiling to this mode: a calibrated level that runs out of headroom
+ * under a heavier load steps down and is calibrated again.
+ *
+ * Without a thermal zone to sample there is nothing to calibrate
+ * against, the mode then holds the animation frequency on the minimum
+ * online cpus, which any device sustains.
+ *
+ * The task is cancelled with the boosts on screen off and posted again
+ * on screen on while the mode is still requested.
+ */
+
+static int frequency_index(struct powerhal_info *pInfo, int freq)
+{
+    for (int i = pInfo->num_available_frequencies - 1; i > 0; i--) {
+        if (pInfo->available_frequencies[i] <= freq)
+            return i;
+    }
+
+    return 0;
+}
+
+static bool load_calibration(struct powerhal_info *pInfo, int *freq, int *cpus)
+{
+    FILE *f = powerhal_fopen(SUSTAINED_CACHE_PATH, "r");
+    bool valid;
+
+    if (!f)
+        return false;
+
+    valid = fscanf(f, "%d %d", freq, cpus) == 2 &&
+        *cpus >= 1 && *cpus <= DEFAULT_MAX_ONLINE_CPUS &&
+        pInfo->available_frequencies[frequency_index(pInfo, *freq)] == *freq;
+    fclose(f);
+
+    return valid;
+}
+
+static void store_calibration(int freq, int cpus)
+{
+    FILE *f = powerhal_fopen(SUSTAINED_CACHE_PATH, "w");
+
+    if (!f) {
+        ALOGE("Error opening %s: %s", SUSTAINED_CACHE_PATH, strerror(errno));
+        return;
+    }
+
+    fprintf(f, "%d %d\n", freq, cpus);
+    fclose(f);
+}
+
+class SustainedMode : public TimeoutPoker::Task {
+public:
+    SustainedMode(struct powerhal_info *pInfo) :
+        mInfo(pInfo),
+        mFreqFd(-1),
+        mFreqMaxFd(-1),
+        mCpusFd(-1),
+        mCpusMaxFd(-1),
+        mFreq(0),
+        mCpus(0),
+        mCalibrated(false),
+        mStopped(false),
+        mStableSince(0) {
+        category = BOOST_CATEGORY_SUSTAINED;
+    }
+
+    virtual ~SustainedMode() {
+        release();
+        // Cancelled: let the next request post a new task
+        if (!mStopped)
+            mInfo->sustained.running.store(false);
+    }
+
+    virtual nsecs_t run(nsecs_t now);
+
+private:
+    void release();
+    void pin(int freq, int cpus);
+    bool stepDown();
+
+    struct powerhal_info *mInfo;
+    int mFreqFd;
+    int mFreqMaxFd;
+    int mCpusFd;
+    int mCpusMaxFd;
+    int mFreq;
+    int mCpus;
+    bool mCalibrated;
+    bool mStopped;
+    nsecs_t mStableSince;
+};
+
+void SustainedMode::release()
+{
+    int *fds[] = { &mFreqFd, &mFreqMaxFd, &mCpusFd, &mCpusMaxFd };
+
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+    mFreq = 0;
+    mCpus = 0;
+}
+
+/* Floor and ceiling at the same value, synchronous as this runs on the poker thread */
+void SustainedMode::pin(int freq, int cpus)
+{
+    TimeoutPoker* poker = get_timeout_poker(mInfo);
+
+    if (freq == mFreq && cpus == mCpus)
+        return;
+
+    release();
+    if (!powerhal_access("/dev/constraint_cpu_freq", W_OK)) {
+        mFreqFd = poker->requestPmQos("/dev/constraint_cpu_freq",
+                SUSTAINED_QOS_PRIORITY, freq, freq);
+        mCpusFd = poker->requestPmQos("/dev/constraint_online_cpus",
+                SUSTAINED_QOS_PRIORITY, cpus, cpus);
+    } else {
+        mFreqFd = poker->requestPmQos("/dev/cpu_freq_min", freq);
+        mFreqMaxFd = poker->requestPmQos("/dev/cpu_freq_max", freq);
+        mCpusFd = poker->requestPmQos("/dev/min_online_cpus", cpus);
+        mCpusMaxFd = poker->requestPmQos("/dev/max_online_cpus", cpus);
+    }
+
+    mFreq = freq;
+    mCpus = cpus;
+    ALOGI("Sustained performance at %d kHz on %d cpus", freq, cpus);
+}
+
+/* Frequency first, then cores once down to the animation frequency */
+bool SustainedMode::stepDown()
+{
+    int i = frequency_index(mInfo, mFreq);
+
+    if (mFreq > mInfo->animation_boost_frequency && i > 0) {
+        pin(mInfo->available_frequencies[i - 1], mCpus);
+        return true;
+    }
+    if (mCpus > DEFAULT_MIN_ONLINE_CPUS) {
+        pin(mFreq, mCpus - 1);
+        return true;
+    }
+
+    return false;
+}
+
+nsecs_t SustainedMode::run(nsecs_t now)
+{
+    struct powerhal_info *pInfo = mInfo;
+    int freq, cpus;
+
+    if (!pInfo->sustained.active.load()) {
+        pInfo->sustained.running.store(false);
+        // Re-entered while we were stopping
+        if (!pInfo->sustained.active.load() || pInfo->sustained.running.exchange(true)) {
+            mStopped = true;
+            return 0;
+        }
+    }
+
+    if (!mFreq) {
+        if (!pInfo->thermal_zones) {
+            // Neither calibrate nor trust a level calibrated elsewhere
+            freq = pInfo->animation_boost_frequency;
+            cpus = DEFAULT_MIN_ONLINE_CPUS;
+            mCalibrated = true;
+            ALOGI("No thermal zone, sustained performance at a fixed cap");
+        } else {
+            mCalibrated = load_calibration(pInfo, &freq, &cpus);
+        }
+        if (!mCalibrated) {
+            freq = pInfo->max_frequency;
+            cpus = DEFAULT_MAX_ONLINE_CPUS;
+            ALOGI("Calibrating sustained performance level");
+        }
+        pin(freq, cpus);
+        mStableSince = now;
+        return ms2ns(SUSTAINED_SAMPLE_MS);
+    }
+
+    if (pInfo->thermal_headroom.load() < THERMAL_HEADROOM_LOW) {
+        // Calibrated under a lighter load, find the level again
+        if (mCalibrated)
+            ALOGI("Sustained performance level too hot, recalibrating");
+        mCalibrated = false;
+        if (stepDown())
+            mStableSince = now;
+    } else if (!mCalibrated && now - mStableSince >= s2ns(SUSTAINED_STABLE_S)) {
+        mCalibrated = true;
+        store_calibration(mFreq, mCpus);
+        ALOGI("Sustained performance calibrated at %d kHz on %d cpus", mFreq, mCpus);
+    }
+
+    return ms2ns(SUSTAINED_SAMPLE_MS);
+}
+
+void sustained_mode_set(struct powerhal_info *pInfo, bool on)
+{
+    if (on != pInfo->sustained.active.load())
+        ALOGI("Sustained performance mode %s", on ? "on" : "off");
+
+    pInfo->sustained.active.store(on);
+    if (on && !pInfo->sustained.running.exchange(true))
+        get_timeout_poker(pInfo)->postTask(new SustainedMode(pInfo), 0);
+}
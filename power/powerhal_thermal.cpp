@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "powerHAL::thermal"
+
+#include <stdio.h>
+
+#include "powerhal.h"
+
+#define THERMAL_ZONE_PATH "/sys/class/thermal/thermal_zone%d/"
+#define MAX_THERMAL_ZONES 8
+#define MAX_TRIP_POINTS 8
+
+/*
+ * Samples the thermal zones and keeps the headroom to the closest
+ * passive (throttling) trip point. As the headroom shrinks the cpu
+ * frequency ceiling is stepped down, so that boosts stay under what
+ * the kernel would throttle to instead of oscillating around it.
+ */
+struct thermal_zone {
+    char temp_path[64];
+    /* Lowest passive trip point, in millidegrees */
+    int trip;
+};
+
+/* Some zones report degrees, most millidegrees */
+static int read_millidegrees(const char *path)
+{
+    char buf[16];
+    int val;
+
+    memset(buf, 0, sizeof(buf));
+    sysfs_read(path, buf, sizeof(buf) - 1);
+    val = atoi(buf);
+    return (val > 0 && val < 1000) ? val * 1000 : val;
+}
+
+static int find_passive_trip(const char *zone)
+{
+    char path[96];
+    char type[16];
+    int trip = 0;
+
+    for (int i = 0; i < MAX_TRIP_POINTS; i++) {
+        snprintf(path, sizeof(path), "%strip_point_%d_type", zone, i);
+        if (powerhal_access(path, R_OK))
+            break;
+
+        memset(type, 0, sizeof(type));
+        sysfs_read(path, type, sizeof(type) - 1);
+        if (strncmp(type, "passive", 7))
+            continue;
+
+        snprintf(path, sizeof(path), "%strip_point_%d_temp", zone, i);
+        int temp = read_millidegrees(path);
+        if (temp > 0 && (!trip || temp < trip))
+            trip = temp;
+    }
+
+    return trip;
+}
+
+class ThermalSampler : public TimeoutPoker::Task {
+public:
+    ThermalSampler(struct powerhal_info *pInfo) :
+        mInfo(pInfo),
+        mNumZones(0),
+        mLevel(0),
+        mFd(-1) {}
+
+    virtual ~ThermalSampler() {
+        if (mFd >= 0)
+            close(mFd);
+    }
+
+    int findZones();
+    virtual nsecs_t run(nsecs_t now);
+
+private:
+    int headroom();
+    void setLevel(int level);
+
+    struct powerhal_info *mInfo;
+    struct thermal_zone mZones[MAX_THERMAL_ZONES];
+    int mNumZones;
+    int mLevel;
+    int mFd;
+};
+
+int ThermalSampler::findZones()
+{
+    char zone[64];
+
+    for (int i = 0; i < MAX_THERMAL_ZONES && mNumZones < MAX_THERMAL_ZONES; i++) {
+        snprintf(zone, sizeof(zone), THERMAL_ZONE_PATH, i);
+        if (powerhal_access(zone, F_OK))
+            break;
+
+        int trip = find_passive_trip(zone);
+        if (!trip)
+            continue;
+
+        snprintf(mZones[mNumZones].temp_path, sizeof(mZones[mNumZones].temp_path),
+                "%stemp", zone);
+        mZones[mNumZones].trip = trip;
+        ALOGI("thermal_zone%d throttles at %d mC", i, trip);
+        mNumZones++;
+    }
+
+    return mNumZones;
+}
+
+/* Smallest distance to a passive trip point, in millidegrees */
+int ThermalSampler::headroom()
+{
+    int headroom = INT32_MAX;
+
+    for (int i = 0; i < mNumZones; i++) {
+        int h = mZones[i].trip - read_millidegrees(mZones[i].temp_path);
+        if (h < headroom)
+            headroom = h;
+    }
+
+    return headroom;
+}
+
+/*
+ * Level 0 leaves boosts alone, level 1 caps them at the interaction
+ * frequency and level 2 at the animation frequency.
+ */
+void ThermalSampler::setLevel(int level)
+{
+    TimeoutPoker* poker = get_timeout_poker(mInfo);
+    int max = 0;
+
+    if (level == mLevel)
+        return;
+
+    if (mFd >= 0) {
+        close(mFd);
+        mFd = -1;
+    }
+
+    if (level == 1)
+        max = mInfo->interaction_boost_frequency;
+    else if (level == 2)
+        max = mInfo->animation_boost_frequency;
+
+    // Synchronous opens, this runs on the poker thread
+    if (max) {
+        if (!powerhal_access("/dev/constraint_cpu_freq", W_OK))
+            mFd = poker->requestPmQos("/dev/constraint_cpu_freq",
+                    THERMAL_QOS_PRIORITY, max, PM_QOS_DEFAULT_VALUE);
+        else
+            mFd = poker->requestPmQos("/dev/cpu_freq_max", max);
+    }
+
+    mInfo->thermal_max_frequency.store(max);
+    mLevel = level;
+    ALOGI("Thermal boost ceiling %d kHz", max);
+}
+
+nsecs_t ThermalSampler::run(__attribute__ ((unused)) nsecs_t now)
+{
+    int h = headroom();
+    int level = mLevel;
+
+    mInfo->thermal_headroom.store(h);
+
+    // Step down at once, back up only with some margin
+    if (h < THERMAL_HEADROOM_LOW)
+        level = 2;
+    else if (h < THERMAL_HEADROOM_HIGH)
+        level = level == 2 && h < THERMAL_HEADROOM_LOW + THERMAL_HYSTERESIS ? 2 : 1;
+    else if (h >= THERMAL_HEADROOM_HIGH + THERMAL_HYSTERESIS)
+        level = 0;
+
+    // Sustained mode steps its own level down against the same headroom
+    if (mInfo->sustained.active.load())
+        level = 0;
+
+    setLevel(level);
+
+    return ms2ns(mInfo->interactive ? THERMAL_SAMPLE_MS : THERMAL_SAMPLE_OFF_MS);
+}
+
+void start_thermal_sampler(struct powerhal_info *pInfo)
+{
+    ThermalSampler* sampler = new ThermalSampler(pInfo);
+
+    pInfo->thermal_zones = sampler->findZones();
+    if (!pInfo->thermal_zones) {
+        ALOGI("No passive trip points, thermal ceiling disabled");
+        delete sampler;
+        return;
+    }
+
+    get_timeout_poker(pInfo)->postTask(sampler, ms2ns(THERMAL_SAMPLE_MS));
+}
@@ -15,41 +15,226 @@
  */
 #define LOG_TAG "powerHAL::common"
 
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
 #include "powerhal_utils.h"
 
-void sysfs_write(const char *path, const char *s)
+/*
+ * Handles of recently used sysfs nodes are kept open and rewritten at
+ * offset 0, the last value written is remembered so that repeating it
+ * costs no syscall. Any I/O error drops the handle, the next access
+ * reopens the node.
+ */
+static pthread_once_t root_once = PTHREAD_ONCE_INIT;
+static const char *root;
+
+static void root_init(void)
 {
-    char buf[80];
-    int len;
-    int fd = open(path, O_WRONLY);
+    const char *r = getenv(POWERHAL_ROOT_ENV);
 
-    if (fd < 0) {
-        strerror_r(errno, buf, sizeof(buf));
-        ALOGE("Error opening %s: %s\n", path, buf);
-        return;
+    root = r && r[0] ? r : NULL;
+    if (root)
+        ALOGW("Resolving paths under %s", root);
+}
+
+const char *powerhal_path(const char *path, char *buf, size_t size)
+{
+    pthread_once(&root_once, root_init);
+    if (!root || path[0] != '/')
+        return path;
+
+    // Never fall back to the real node
+    if (snprintf(buf, size, "%s%s", root, path) >= (int)size) {
+        ALOGE("Path too long under %s: %s", root, path);
+        buf[0] = '\0';
     }
+    return buf;
+}
 
-    len = write(fd, s, strlen(s));
-    if (len < 0) {
+int powerhal_open(const char *path, int flags, mode_t mode)
+{
+    char buf[POWERHAL_PATH_MAX];
+
+    return open(powerhal_path(path, buf, sizeof(buf)), flags, mode);
+}
+
+int powerhal_access(const char *path, int mode)
+{
+    char buf[POWERHAL_PATH_MAX];
+
+    return access(powerhal_path(path, buf, sizeof(buf)), mode);
+}
+
+FILE *powerhal_fopen(const char *path, const char *mode)
+{
+    char buf[POWERHAL_PATH_MAX];
+
+    return fopen(powerhal_path(path, buf, sizeof(buf)), mode);
+}
+
+/*
+ * Sized for the nodes touched in steady state: the samplers read up to
+ * 8 thermal zones, /proc/stat, time_in_state and the vsync miss count
+ * every period, and a screen or hint transition writes up to 12 input
+ * devices, the governor and cpuquiet tunables. A smaller cache makes
+ * each sampler period evict the handles of the next transition.
+ */
+#define SYSFS_CACHE_SIZE 48
+#define SYSFS_PATH_MAX 96
+#define SYSFS_VALUE_MAX 32
+
+struct sysfs_handle {
+    char path[SYSFS_PATH_MAX];
+    int flags;
+    int fd;
+    bool value_valid;
+    char value[SYSFS_VALUE_MAX];
+    unsigned int last_used;
+};
+
+static pthread_mutex_t sysfs_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sysfs_handle sysfs_cache[SYSFS_CACHE_SIZE];
+static unsigned int sysfs_cache_clock;
+
+static void sysfs_handle_close(struct sysfs_handle *h)
+{
+    if (h->path[0])
+        close(h->fd);
+    h->path[0] = '\0';
+    h->fd = -1;
+    h->value_valid = false;
+}
+
+/* Called with sysfs_cache_lock held */
+static struct sysfs_handle *sysfs_handle_get(const char *path, int flags)
+{
+    struct sysfs_handle *victim = &sysfs_cache[0];
+    int fd;
+    int i;
+
+    for (i = 0; i < SYSFS_CACHE_SIZE; i++) {
+        struct sysfs_handle *h = &sysfs_cache[i];
+
+        if (h->path[0] && h->flags == flags && !strcmp(h->path, path)) {
+            h->last_used = ++sysfs_cache_clock;
+            return h;
+        }
+        if (!h->path[0])
+            victim = h;
+        else if (victim->path[0] && h->last_used < victim->last_used)
+            victim = h;
+    }
+
+    fd = powerhal_open(path, flags);
+    if (fd < 0)
+        return NULL;
+
+    if (strlen(path) >= SYSFS_PATH_MAX) {
+        /* Too long to be cached, caller closes it */
+        static struct sysfs_handle uncached;
+        uncached.path[0] = '\0';
+        uncached.fd = fd;
+        uncached.value_valid = false;
+        return &uncached;
+    }
+
+    sysfs_handle_close(victim);
+    strcpy(victim->path, path);
+    victim->flags = flags;
+    victim->fd = fd;
+    victim->last_used = ++sysfs_cache_clock;
+    return victim;
+}
+
+static void sysfs_handle_put(struct sysfs_handle *h)
+{
+    if (!h->path[0]) {
+        close(h->fd);
+        h->fd = -1;
+    }
+}
+
+/* Returns false when the value was known to be current or the write failed */
+static bool sysfs_write_locked(const char *path, const char *s, bool dedup)
+{
+    char buf[80];
+    struct sysfs_handle *h;
+    size_t size = strlen(s);
+    ssize_t len;
+    int retry;
+
+    for (retry = 0; retry < 2; retry++) {
+        h = sysfs_handle_get(path, O_WRONLY);
+        if (!h) {
+            strerror_r(errno, buf, sizeof(buf));
+            ALOGE("Error opening %s: %s\n", path, buf);
+            return false;
+        }
+
+        if (dedup && h->value_valid && !strcmp(h->value, s))
+            return false;
+
+        len = pwrite(h->fd, s, size, 0);
+        if (len >= 0) {
+            h->value_valid = dedup && size < SYSFS_VALUE_MAX;
+            if (h->value_valid)
+                strcpy(h->value, s);
+            sysfs_handle_put(h);
+            return true;
+        }
+
+        /* The node may have been recreated, e.g. by a governor switch */
         strerror_r(errno, buf, sizeof(buf));
-        ALOGE("Error writing to %s: %s\n", path, buf);
+        if (h->path[0])
+            sysfs_handle_close(h);
+        else
+            sysfs_handle_put(h);
     }
-    close(fd);
+
+    ALOGE("Error writing to %s: %s\n", path, buf);
+    return false;
+}
+
+bool sysfs_write(const char *path, const char *s)
+{
+    bool written;
+
+    pthread_mutex_lock(&sysfs_cache_lock);
+    written = sysfs_write_locked(path, s, true);
+    pthread_mutex_unlock(&sysfs_cache_lock);
+
+    return written;
+}
+
+void sysfs_write_trigger(const char *path, const char *s)
+{
+    pthread_mutex_lock(&sysfs_cache_lock);
+    sysfs_write_locked(path, s, false);
+    pthread_mutex_unlock(&sysfs_cache_lock);
 }
 
 void sysfs_read(const char *path, char *s, int size)
 {
+    struct sysfs_handle *h;
     int len;
-    int fd = open(path, O_RDONLY);
 
-    if (fd < 0) {
+    pthread_mutex_lock(&sysfs_cache_lock);
+    h = sysfs_handle_get(path, O_RDONLY);
+    if (!h) {
+        pthread_mutex_unlock(&sysfs_cache_lock);
         strerror_r(errno, s, size);
         ALOGE("Error opening %s: %s\n", path, s);
         return;
     }
 
-    len = read(fd, s, size);
-    close(fd);
+    len = pread(h->fd, s, size, 0);
+    if (len < 0 && h->path[0])
+        sysfs_handle_close(h);
+    else
+        sysfs_handle_put(h);
+    pthread_mutex_unlock(&sysfs_cache_lock);
 
     if (len < 0) {
         strerror_r(errno, s, size);
@@ -57,10 +242,23 @@ void sysfs_read(const char *path, char *s, int size)
     }
 }
 
+void sysfs_invalidate(const char *prefix)
+{
+    size_t n = strlen(prefix);
+    int i;
+
+    pthread_mutex_lock(&sysfs_cache_lock);
+    for (i = 0; i < SYSFS_CACHE_SIZE; i++) {
+        if (sysfs_cache[i].path[0] && !strncmp(sysfs_cache[i].path, prefix, n))
+            sysfs_handle_close(&sysfs_cache[i]);
+    }
+    pthread_mutex_unlock(&sysfs_cache_lock);
+}
+
 bool sysfs_exists(const char *path)
 {
     bool val;
-    int fd = open(path, O_RDONLY);
+    int fd = powerhal_open(path, O_RDONLY);
 
     val = fd < 0 ? false : true;
     close(fd);
@@ -106,3 +304,81 @@ void sysfs_write_int(const char *path, int value)
     snprintf(val, sizeof(val), "%d", value);
     sysfs_write(path, val);
 }
+
+void sysfs_write_int_trigger(const char *path, int value)
+{
+    char val[PROPERTY_VALUE_MAX];
+
+    snprintf(val, sizeof(val), "%d", value);
+    sysfs_write_trigger(path, val);
+}
+
+bool read_cpu_times(struct cpu_times *t)
+{
+    char buf[256];
+    unsigned long long user, nice, system, idle, iowait, irq, softirq;
+
+    memset(buf, 0, sizeof(buf));
+    sysfs_read("/proc/stat", buf, sizeof(buf) - 1);
+    if (sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice,
+                &system, &idle, &iowait, &irq, &softirq) != 7)
+        return false;
+
+    t->busy = user + nice + system + irq + softirq;
+    t->total = t->busy + idle + iowait;
+    return true;
+}
+
+int cpu_busy_percent(const struct cpu_times *prev, const struct cpu_times *now)
+{
+    uint64_t total = now->total - prev->total;
+
+    if (!prev->total || !total)
+        return 0;
+
+    return (int)((now->busy - prev->busy) * 100 / total);
+}
+
+bool read_percpu_times(struct cpu_times *t, int count)
+{
+    char buf[1024];
+    unsigned long long user, nice, system, idle, iowait, irq, softirq;
+    const char *line;
+    int cpu;
+    bool found = false;
+
+    memset(t, 0, count * sizeof(*t));
+    memset(buf, 0, sizeof(buf));
+    sysfs_read("/proc/stat", buf, sizeof(buf) - 1);
+
+    for (line = strstr(buf, "\ncpu"); line; line = strstr(line + 1, "\ncpu")) {
+        if (sscanf(line + 1, "cpu%d %llu %llu %llu %llu %llu %llu %llu", &cpu, &user,
+                    &nice, &system, &idle, &iowait, &irq, &softirq) != 8 ||
+                cpu < 0 || cpu >= count)
+            continue;
+
+        t[cpu].busy = user + nice + system + irq + softirq;
+        t[cpu].total = t[cpu].busy + idle + iowait;
+        found = true;
+    }
+
+    return found;
+}
+
+int busiest_cpu_percent(const struct cpu_times *prev, const struct cpu_times *now,
+        int count)
+{
+    int busiest = 0;
+
+    for (int i = 0; i < count; i++) {
+        int busy;
+
+        if (!now[i].total || now[i].total < prev[i].total)
+            continue;
+        busy = cpu_busy_percent(&prev[i], &now[i]);
+        if (busy > busiest)
+            busiest = busy;
+    }
+
+    return busiest;
+}
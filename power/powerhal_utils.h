@@ -19,22 +19,66 @@
 #define POWER_HAL_UTILS_H
 
 #include <errno.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <fcntl.h>
 #include <dlfcn.h>
+#include <stdio.h>
 
 #include <utils/Log.h>
 #include <cutils/properties.h>
 
-/* sysfs utilities */
-void sysfs_write(const char *path, const char *s);
+/* Path roots
+ * With POWERHAL_ROOT_ENV set in the environment, every absolute path the
+ * HAL opens is resolved under that directory instead, so that it can run
+ * against a fake sysfs/devfs tree. Devices leave it unset.
+ */
+#define POWERHAL_ROOT_ENV "POWERHAL_ROOT"
+#define POWERHAL_PATH_MAX 160
+
+/* Returns path, or its copy under the root written to buf */
+const char *powerhal_path(const char *path, char *buf, size_t size);
+int powerhal_open(const char *path, int flags, mode_t mode = 0);
+int powerhal_access(const char *path, int mode);
+FILE *powerhal_fopen(const char *path, const char *mode);
+
+/* sysfs utilities
+ * Writes go through a cache of open handles and are skipped when the
+ * value did not change, the _trigger variants always write (for nodes
+ * such as boostpulse where the write itself is the event).
+ */
+/* Returns true when the node was written, false when it already held s */
+bool sysfs_write(const char *path, const char *s);
 void sysfs_write_int(const char *path, int value);
+void sysfs_write_trigger(const char *path, const char *s);
+void sysfs_write_int_trigger(const char *path, int value);
 void sysfs_read(const char *path, char *s, int size);
+/* Drops cached handles and values of nodes under prefix */
+void sysfs_invalidate(const char *prefix);
 bool sysfs_exists(const char *path);
 
+/* Aggregate cpu time from the first line of /proc/stat, in jiffies */
+struct cpu_times {
+    uint64_t busy;
+    uint64_t total;
+};
+
+bool read_cpu_times(struct cpu_times *t);
+/* Busy share of the interval between two samples, in percent */
+int cpu_busy_percent(const struct cpu_times *prev, const struct cpu_times *now);
+
+/* Per cpu times from the cpuN lines of /proc/stat, indexed by cpu.
+ * Offline cpus have no line and are left zeroed.
+ */
+#define POWERHAL_MAX_CPUS 8
+bool read_percpu_times(struct cpu_times *t, int count);
+/* Busy share of the busiest cpu online in both samples, in percent */
+int busiest_cpu_percent(const struct cpu_times *prev, const struct cpu_times *now,
+        int count);
+
 /* Property utilities */
 bool get_property_bool(const char *key, bool default_value);
 void set_property_int(const char *key, int value);
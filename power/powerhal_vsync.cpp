@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "powerHAL::vsync"
+
+#include "powerhal.h"
+
+/*
+ * While vsync is on, the boost level is re-evaluated every window: a
+ * missed-frame rate above VSYNC_MISS_TARGET_PERMILLE steps it up, and
+ * VSYNC_QUIET_WINDOWS windows without misses step it down.
+ *
+ * Misses are read from the counter named by VSYNC_MISS_NODE_PROP when
+ * the display driver exports one. Otherwise cpu load from /proc/stat is
+ * the proxy: a busy window is counted as at risk, an idle one as quiet.
+ */
+
+/* Boost of each level, level 0 does not boost */
+static void vsync_level(struct powerhal_info *pInfo, int level, int *freq, int *min_cpus)
+{
+    const struct hint_profile *p = &pInfo->profiles[POWER_HINT_VSYNC];
+
+    switch (level) {
+    case 0:
+        *freq = 0;
+        *min_cpus = 0;
+        break;
+    case 1:
+        *freq = pInfo->animation_boost_frequency;
+        *min_cpus = 0;
+        break;
+    case 2:
+        *freq = pInfo->interaction_boost_frequency;
+        *min_cpus = DEFAULT_MIN_ONLINE_CPUS;
+        break;
+    default:
+        *freq = p->freq;
+        *min_cpus = p->min_cpus;
+        break;
+    }
+
+    if (p->freq && *freq > p->freq)
+        *freq = p->freq;
+}
+
+static bool read_miss_counter(struct powerhal_info *pInfo, uint64_t *misses)
+{
+    char buf[32];
+
+    if (!pInfo->vsync.miss_node[0])
+        return false;
+
+    memset(buf, 0, sizeof(buf));
+    sysfs_read(pInfo->vsync.miss_node, buf, sizeof(buf) - 1);
+    *misses = strtoull(buf, NULL, 10);
+    return true;
+}
+
+/* Returns 1 to step up, -1 for a quiet window, 0 otherwise */
+static int vsync_feedback(struct powerhal_info *pInfo)
+{
+    struct cpu_times now;
+    uint64_t misses;
+
+    if (read_miss_counter(pInfo, &misses)) {
+        uint64_t missed = misses - pInfo->vsync.last_misses;
+        uint64_t frames = VSYNC_WINDOW_MS * 1000 / VSYNC_PERIOD_US;
+
+        pInfo->vsync.last_misses = misses;
+        if (missed * 1000 > frames * VSYNC_MISS_TARGET_PERMILLE)
+            return 1;
+        return missed ? 0 : -1;
+    }
+
+    if (!read_cpu_times(&now))
+        return 0;
+
+    int busy = cpu_busy_percent(&pInfo->vsync.last_times, &now);
+    pInfo->vsync.last_times = now;
+    if (busy >= VSYNC_BUSY_HIGH)
+        return 1;
+    return busy < VSYNC_BUSY_LOW ? -1 : 0;
+}
+
+class VsyncGovernor : public TimeoutPoker::Task {
+public:
+    VsyncGovernor(struct powerhal_info *pInfo) : mInfo(pInfo) {}
+
+    virtual nsecs_t run(nsecs_t now);
+
+private:
+    struct powerhal_info *mInfo;
+};
+
+nsecs_t VsyncGovernor::run(__attribute__ ((unused)) nsecs_t now)
+{
+    struct powerhal_info *pInfo = mInfo;
+    int freq, min_cpus;
+
+    if (!pInfo->vsync.active.load()) {
+        pInfo->vsync.running.store(false);
+        // vsync came back while we were stopping
+        if (!pInfo->vsync.active.load() || pInfo->vsync.running.exchange(true))
+            return 0;
+    }
+
+    if (pInfo->vsync.started) {
+        int feedback = vsync_feedback(pInfo);
+
+        if (feedback > 0) {
+            pInfo->vsync.quiet_windows = 0;
+            if (pInfo->vsync.level < VSYNC_LEVELS - 1)
+                pInfo->vsync.level++;
+        } else if (feedback < 0 &&
+                ++pInfo->vsync.quiet_windows >= VSYNC_QUIET_WINDOWS) {
+            pInfo->vsync.quiet_windows = 0;
+            if (pInfo->vsync.level > 0)
+                pInfo->vsync.level--;
+        }
+    } else {
+        // Baseline for the first window
+        vsync_feedback(pInfo);
+        pInfo->vsync.started = true;
+    }
+
+    vsync_level(pInfo, pInfo->vsync.level, &freq, &min_cpus);
+    if (pInfo->low_power.enabled)
+        freq = min_cpus = 0;
+    cap_boost(pInfo, &freq, &min_cpus);
+
+    // Held a little past the window so consecutive windows overlap
+    if (freq)
+        get_timeout_poker(pInfo)->requestPmQosTimed("/dev/cpu_freq_min",
+                                                    freq,
+                                                    ms2ns(VSYNC_WINDOW_MS * 3 / 2),
+                                                    BOOST_CATEGORY_VSYNC);
+    if (min_cpus)
+        get_timeout_poker(pInfo)->requestPmQosTimed("/dev/min_online_cpus",
+                                                    min_cpus,
+                                                    ms2ns(VSYNC_WINDOW_MS * 3 / 2),
+                                                    BOOST_CATEGORY_VSYNC);
+
+    return ms2ns(VSYNC_WINDOW_MS);
+}
+
+void vsync_governor_init(struct powerhal_info *pInfo)
+{
+    property_get(VSYNC_MISS_NODE_PROP, pInfo->vsync.miss_node, "");
+    if (pInfo->vsync.miss_node[0] && powerhal_access(pInfo->vsync.miss_node, R_OK)) {
+        ALOGW("Cannot read %s, using cpu load as vsync feedback", pInfo->vsync.miss_node);
+        pInfo->vsync.miss_node[0] = '\0';
+    }
+    pInfo->vsync.level = VSYNC_LEVELS - 1;
+}
+
+void vsync_governor_set(struct powerhal_info *pInfo, bool on)
+{
+    pInfo->vsync.active.store(on);
+    if (on && !pInfo->vsync.running.exchange(true)) {
+        pInfo->vsync.started = false;
+        get_timeout_poker(pInfo)->postTask(new VsyncGovernor(pInfo), 0);
+    }
+}
@@ -26,13 +26,24 @@ static struct input_dev_map input_devs[] = {
 		{-1, "ft5x0x_ts\n"},
        };
 
-static void tegra3_power_init(struct power_module *module)
+static pthread_once_t alloc_once = PTHREAD_ONCE_INIT;
+
+static void tegra3_power_alloc(void)
 {
+    pInfo = (powerhal_info*)calloc(1, sizeof(powerhal_info));
     if (!pInfo)
-        pInfo = (powerhal_info*)calloc(1, sizeof(powerhal_info));
+        return;
 
     pInfo->input_devs = input_devs;
     pInfo->input_cnt = sizeof(input_devs)/sizeof(struct input_dev_map);
+}
+
+static void tegra3_power_init(struct power_module *module)
+{
+    pthread_once(&alloc_once, tegra3_power_alloc);
+    if (!pInfo)
+        return;
+
     common_power_init(module, pInfo);
 }
 
@@ -71,35 +82,33 @@ static int tegra3_power_open(__attribute__ ((unused)) const hw_module_t *module,
     if (strcmp(name, POWER_HARDWARE_MODULE_ID))
         return -EINVAL;
 
-    if (!pInfo) {
-        pInfo = (powerhal_info*)calloc(1, sizeof(powerhal_info));
-        power_module *dev = (power_module *)calloc(1,
-                sizeof(power_module));
+    pthread_once(&alloc_once, tegra3_power_alloc);
+    if (!pInfo)
+        return -ENOMEM;
+
+    power_module *dev = (power_module *)calloc(1,
+            sizeof(power_module));
 
-        if (dev) {
-            /* Common hw_device_t fields */
-            dev->common.tag = HARDWARE_MODULE_TAG;
+    if (dev) {
+        /* Common hw_device_t fields */
+        dev->common.tag = HARDWARE_MODULE_TAG;
 #ifdef ANDROID_API_LP_OR_LATER
-            dev->common.module_api_version = POWER_MODULE_API_VERSION_0_3;
+        dev->common.module_api_version = POWER_MODULE_API_VERSION_0_3;
 #else
-            dev->common.module_api_version = POWER_MODULE_API_VERSION_0_2;
+        dev->common.module_api_version = POWER_MODULE_API_VERSION_0_2;
 #endif
-            dev->common.hal_api_version = HARDWARE_HAL_API_VERSION;
-            dev->init = tegra3_power_init;
-            dev->setInteractive = tegra3_power_set_interactive;
-            dev->powerHint = tegra3_power_hint;
+        dev->common.hal_api_version = HARDWARE_HAL_API_VERSION;
+        dev->init = tegra3_power_init;
+        dev->setInteractive = tegra3_power_set_interactive;
+        dev->powerHint = tegra3_power_hint;
 #ifdef ANDROID_API_LP_OR_LATER
-            dev->setFeature = tegra3_set_feature;
+        dev->setFeature = tegra3_set_feature;
 #endif
-            *device = (hw_device_t*)dev;
-        } else
-            return -ENOMEM;
-
-        if(pInfo)
-            common_power_open(pInfo);
-        else
-            return -ENOMEM;
-    }
+        *device = (hw_device_t*)dev;
+    } else
+        return -ENOMEM;
+
+    common_power_open(pInfo);
 
     return 0;
 }
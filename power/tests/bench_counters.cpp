@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#include "bench_counters.h"
+
+static std::atomic<int64_t> sAllocs(0);
+
+void* operator new(size_t size)
+{
+    void* p;
+
+    sAllocs.fetch_add(1, std::memory_order_relaxed);
+    p = malloc(size ? size : 1);
+    // Built without exceptions
+    if (!p)
+        abort();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void readBenchCounters(BenchCounters* c)
+{
+    struct rusage ru;
+    char line[64];
+    long long val;
+    FILE* f;
+
+    c->allocs = sAllocs.load(std::memory_order_relaxed);
+
+    c->syscalls = -1;
+    f = fopen("/proc/self/io", "r");
+    if (f) {
+        c->syscalls = 0;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "syscr: %lld", &val) == 1 ||
+                    sscanf(line, "syscw: %lld", &val) == 1)
+                c->syscalls += val;
+        }
+        fclose(f);
+    }
+
+    getrusage(RUSAGE_SELF, &ru);
+    c->switches = ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+BenchCounters benchCountersDelta(const BenchCounters& before, const BenchCounters& after)
+{
+    BenchCounters d;
+
+    d.allocs = after.allocs - before.allocs;
+    d.syscalls = before.syscalls < 0 || after.syscalls < 0 ? -1 :
+            after.syscalls - before.syscalls;
+    d.switches = after.switches - before.switches;
+    return d;
+}
+
+int64_t percentile(std::vector<int64_t>* samples, int p)
+{
+    if (samples->empty())
+        return 0;
+
+    std::sort(samples->begin(), samples->end());
+    return (*samples)[(samples->size() - 1) * p / 100];
+}
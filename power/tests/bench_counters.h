@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef POWER_HAL_TESTS_BENCH_COUNTERS_H
+#define POWER_HAL_TESTS_BENCH_COUNTERS_H
+
+#include <stdint.h>
+
+#include <vector>
+
+/*
+ * Process wide costs sampled around a benchmark run:
+ *  - allocs counts operator new, which the executable linking
+ *    bench_counters.cpp replaces; malloc() from C code is not seen,
+ *  - syscalls counts the read and write family calls of
+ *    /proc/self/io, -1 without CONFIG_TASK_IO_ACCOUNTING,
+ *  - switches counts the context switches of getrusage().
+ */
+struct BenchCounters {
+    int64_t allocs;
+    int64_t syscalls;
+    int64_t switches;
+};
+
+void readBenchCounters(BenchCounters* c);
+// after - before, syscalls stay -1 when unknown
+BenchCounters benchCountersDelta(const BenchCounters& before, const BenchCounters& after);
+
+// pth percentile of samples, sorted in place
+int64_t percentile(std::vector<int64_t>* samples, int p);
+
+#endif
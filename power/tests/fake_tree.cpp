@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fake_tree.h"
+#include "../powerhal_utils.h"
+
+#define GROUPER_CPUS 4
+#ifdef __ANDROID__
+#define DEFAULT_TMPDIR "/data/local/tmp"
+#else
+#define DEFAULT_TMPDIR "/tmp"
+#endif
+
+FakeTree::FakeTree()
+{
+}
+
+static int removeEntry(const char* path, const struct stat* sb, int flag, struct FTW* ftw)
+{
+    (void)sb;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+FakeTree::~FakeTree()
+{
+    if (!mRoot.empty())
+        nftw(mRoot.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+bool FakeTree::create()
+{
+    const char* tmp = getenv("TMPDIR");
+    std::string pattern = std::string(tmp && tmp[0] ? tmp : DEFAULT_TMPDIR) + "/powerhal.XXXXXX";
+    std::vector<char> buf(pattern.begin(), pattern.end());
+
+    buf.push_back('\0');
+    if (!mkdtemp(&buf[0])) {
+        fprintf(stderr, "mkdtemp %s: %s\n", pattern.c_str(), strerror(errno));
+        return false;
+    }
+
+    mRoot = &buf[0];
+    // Read once by the HAL, on its first path lookup
+    setenv(POWERHAL_ROOT_ENV, mRoot.c_str(), 1);
+    return true;
+}
+
+bool FakeTree::makeParents(const char* node)
+{
+    std::string p = path(node);
+
+    for (size_t i = mRoot.size() + 1; (i = p.find('/', i)) != std::string::npos; i++) {
+        if (mkdir(p.substr(0, i).c_str(), 0755) && errno != EEXIST) {
+            fprintf(stderr, "mkdir %s: %s\n", p.substr(0, i).c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FakeTree::addDir(const char* node)
+{
+    std::string p = path(node);
+
+    if (!makeParents(node))
+        return false;
+    if (mkdir(p.c_str(), 0755) && errno != EEXIST) {
+        fprintf(stderr, "mkdir %s: %s\n", p.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool FakeTree::writeInput(const char* node, const char* content)
+{
+    std::string p = path(node);
+    size_t size = strlen(content);
+    int fd = open(p.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    bool ok;
+
+    if (fd < 0) {
+        fprintf(stderr, "open %s: %s\n", p.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Grows or shrinks after the write, a reader never sees it empty
+    ok = pwrite(fd, content, size, 0) == (ssize_t)size && !ftruncate(fd, size);
+    close(fd);
+    return ok;
+}
+
+bool FakeTree::addInput(const char* node, const char* content)
+{
+    return makeParents(node) && writeInput(node, content);
+}
+
+bool FakeTree::addOutput(const char* node, const char* content)
+{
+    if (!addInput(node, content))
+        return false;
+
+    mOutputs.push_back(node);
+    return true;
+}
+
+bool FakeTree::addPmQosNode(const char* node)
+{
+    std::string p = path(node);
+
+    if (!makeParents(node))
+        return false;
+    if (mkfifo(p.c_str(), 0666)) {
+        fprintf(stderr, "mkfifo %s: %s\n", p.c_str(), strerror(errno));
+        return false;
+    }
+
+    mPmQosNodes.push_back(node);
+    return true;
+}
+
+std::string formatProcStat(const long long* busy, const long long* idle, int cpus)
+{
+    long long totalBusy = 0, totalIdle = 0;
+    std::string s;
+    char line[128];
+
+    for (int i = 0; i < cpus; i++) {
+        if (busy[i] < 0)
+            continue;
+        totalBusy += busy[i];
+        totalIdle += idle[i];
+    }
+
+    // Fixed width, so that a rewrite never changes the size
+    snprintf(line, sizeof(line), "cpu  %12lld 0 0 %12lld 0 0 0 0 0 0\n", totalBusy, totalIdle);
+    s = line;
+    for (int i = 0; i < cpus; i++) {
+        if (busy[i] < 0)
+            snprintf(line, sizeof(line), "%*s\n", 46, "");
+        else
+            snprintf(line, sizeof(line), "cpu%d %12lld 0 0 %12lld 0 0 0 0 0 0\n",
+                    i, busy[i], idle[i]);
+        s += line;
+    }
+    s += "intr 0\nctxt 0\nbtime 0\n";
+
+    return s;
+}
+
+bool FakeTree::createGrouper()
+{
+    static const long long busy[GROUPER_CPUS] = { 0, 0, 0, 0 };
+    static const long long idle[GROUPER_CPUS] = { 0, 0, 0, 0 };
+    static const char* const pmQosNodes[] = {
+        "/dev/cpu_freq_min", "/dev/cpu_freq_max",
+        "/dev/min_online_cpus", "/dev/max_online_cpus",
+        "/dev/gpu_freq_min", "/dev/gpu_freq_max",
+    };
+    static const char* const outputs[] = {
+        "/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor",
+        "/sys/devices/system/cpu/cpufreq/intelliactive/io_is_busy",
+        "/sys/devices/system/cpu/cpufreq/intelliactive/boostpulse",
+        "/sys/devices/system/cpu/cpuquiet/tegra_cpuquiet/no_lp",
+        "/sys/devices/system/cpu/cpuquiet/balanced/up_delay",
+        "/sys/devices/system/cpu/cpuquiet/balanced/down_delay",
+        "/sys/devices/system/cpu/cpuquiet/balanced/idle_top_freq",
+        "/sys/devices/system/cpu/cpuquiet/balanced/idle_bottom_freq",
+        "/sys/class/input/input0/enabled",
+        "/sys/android_touch/doubletap_wake",
+    };
+    bool ok = create();
+
+    ok = ok && addInput("/sys/devices/system/cpu/cpu0/cpufreq/scaling_available_frequencies",
+            "51000 102000 204000 340000 475000 640000 760000 860000 1000000 "
+            "1100000 1200000 1300000 \n");
+    ok = ok && addInput("/sys/devices/system/cpu/cpuquiet/tegra_cpuquiet/idle_top_freq",
+            "475000\n");
+    ok = ok && addInput("/sys/devices/system/cpu/cpu0/cpufreq/stats/time_in_state",
+            "51000 0\n475000 0\n1300000 0\n");
+    ok = ok && addInput("/sys/class/input/input0/name", "elan-touchscreen\n");
+    ok = ok && addInput("/proc/stat", formatProcStat(busy, idle, GROUPER_CPUS).c_str());
+    ok = ok && addDir("/data/system");
+
+    for (size_t i = 0; ok && i < sizeof(outputs) / sizeof(outputs[0]); i++)
+        ok = addOutput(outputs[i]);
+    for (size_t i = 0; ok && i < sizeof(pmQosNodes) / sizeof(pmQosNodes[0]); i++)
+        ok = addPmQosNode(pmQosNodes[i]);
+
+    return ok;
+}
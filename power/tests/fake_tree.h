@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef POWER_HAL_TESTS_FAKE_TREE_H
+#define POWER_HAL_TESTS_FAKE_TREE_H
+
+#include <string>
+#include <vector>
+
+/*
+ * sysfs/devfs stand-in for the HAL resolving its paths under
+ * POWERHAL_ROOT. Nodes are named by their device path, e.g.
+ * "/dev/cpu_freq_min", and live at the same path under the root:
+ *  - inputs are regular files the HAL reads, tests may rewrite them,
+ *  - outputs are regular files the HAL writes, seen by WriteRecorder,
+ *  - PM QoS nodes are FIFOs: the HAL holds a request by keeping its
+ *    end open, the value is the last int written to it.
+ */
+class FakeTree {
+public:
+    FakeTree();
+    ~FakeTree();
+
+    // Creates an empty tree under $TMPDIR, /data/local/tmp on a device
+    bool create();
+    // Creates the nodes of a grouper, cpu0-3 online and idle
+    bool createGrouper();
+
+    const char* root() const { return mRoot.c_str(); }
+    std::string path(const char* node) const { return mRoot + node; }
+
+    bool addInput(const char* node, const char* content);
+    bool addOutput(const char* node, const char* content = "");
+    bool addPmQosNode(const char* node);
+    bool addDir(const char* node);
+
+    // Rewrites an input in place, the HAL keeps its nodes open
+    bool writeInput(const char* node, const char* content);
+
+    const std::vector<std::string>& outputs() const { return mOutputs; }
+    const std::vector<std::string>& pmQosNodes() const { return mPmQosNodes; }
+
+private:
+    bool makeParents(const char* node);
+
+    std::string mRoot;
+    std::vector<std::string> mOutputs;
+    std::vector<std::string> mPmQosNodes;
+};
+
+// /proc/stat with the aggregate and cpuN lines of times, in jiffies.
+// Offline cpus have a negative busy time and no line.
+std::string formatProcStat(const long long* busy, const long long* idle, int cpus);
+
+#endif
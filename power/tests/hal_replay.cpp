@@ -0,0 +1,431 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <hardware/hardware.h>
+#include <hardware/power.h>
+#include <cutils/properties.h>
+
+#include "hal_replay.h"
+
+#ifndef POWER_TRACE_DIR
+#define POWER_TRACE_DIR "tests/traces"
+#endif
+
+#define LOAD_CPUS 4
+#define LOAD_TICK_MS 10
+// /proc/stat counts USER_HZ jiffies
+#define JIFFY_MS 10
+
+extern struct power_module HAL_MODULE_INFO_SYM;
+
+HalReplay::HalReplay() :
+    mStart(0)
+{
+}
+
+bool HalReplay::load(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    char line[512];
+
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char op[32];
+        int ms, args;
+
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '#') {
+            char name[64], node[128], value[64];
+            long budget;
+
+            if (sscanf(line, "# budget %63s %ld", name, &budget) == 2) {
+                mBudgets[name] = budget;
+            } else if (sscanf(line, "# expect %d %127s %63s", &ms, node, value) == 3) {
+                TraceExpect e = { ms, node, value };
+                mExpects.push_back(e);
+            }
+            continue;
+        }
+
+        args = strlen(line);
+        if (sscanf(line, "%d %31s %n", &ms, op, &args) < 2)
+            continue;
+
+        TraceRecord r = { ms, op, line + args };
+        mRecords.push_back(r);
+    }
+
+    fclose(f);
+    return !mRecords.empty();
+}
+
+/*
+ * Advances /proc/stat every LOAD_TICK_MS at the load set by the last
+ * "load" record, in hundredths of a jiffy.
+ */
+struct LoadTicker {
+    FakeTree* tree;
+    pthread_mutex_t lock;
+    int percent[LOAD_CPUS];
+    long long busy[LOAD_CPUS];
+    long long idle[LOAD_CPUS];
+};
+
+static void* loadTickerLoop(void* arg)
+{
+    LoadTicker* t = (LoadTicker*)arg;
+    struct timespec next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (;;) {
+        long long busy[LOAD_CPUS], idle[LOAD_CPUS];
+
+        next.tv_nsec += LOAD_TICK_MS * 1000000L;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        pthread_mutex_lock(&t->lock);
+        for (int i = 0; i < LOAD_CPUS; i++) {
+            if (t->percent[i] >= 0) {
+                t->busy[i] += t->percent[i] * LOAD_TICK_MS / JIFFY_MS;
+                t->idle[i] += (100 - t->percent[i]) * LOAD_TICK_MS / JIFFY_MS;
+            }
+            busy[i] = t->percent[i] >= 0 ? t->busy[i] / 100 : -1;
+            idle[i] = t->idle[i] / 100;
+        }
+        pthread_mutex_unlock(&t->lock);
+
+        t->tree->writeInput("/proc/stat", formatProcStat(busy, idle, LOAD_CPUS).c_str());
+    }
+
+    return NULL;
+}
+
+static void sleepUntil(int64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static bool hint(struct power_module* module, const char* args)
+{
+    char name[32], arg[128];
+    int n = sscanf(args, "%31s %127s", name, arg);
+    int val = n == 2 ? atoi(arg) : 0;
+
+    if (n < 1)
+        return false;
+
+    if (!strcmp(name, "vsync")) {
+        module->powerHint(module, POWER_HINT_VSYNC, val ? (void*)1 : NULL);
+    } else if (!strcmp(name, "interaction")) {
+        module->powerHint(module, POWER_HINT_INTERACTION, n == 2 ? &val : NULL);
+#ifdef ANDROID_API_LP_OR_LATER
+    } else if (!strcmp(name, "launch")) {
+        launch_boost_info_t info;
+
+        info.pid = 0;
+        info.packageName = n == 2 ? arg : NULL;
+        module->powerHint(module, POWER_HINT_LAUNCH_BOOST, &info);
+    } else if (!strcmp(name, "low_power")) {
+        module->powerHint(module, POWER_HINT_LOW_POWER, val ? &val : NULL);
+    } else if (!strcmp(name, "sustained")) {
+        module->powerHint(module, POWER_HINT_SUSTAINED_PERFORMANCE, &val);
+#endif
+    } else if (!strcmp(name, "video_encode")) {
+        module->powerHint(module, POWER_HINT_VIDEO_ENCODE, NULL);
+    } else if (!strcmp(name, "video_decode")) {
+        module->powerHint(module, POWER_HINT_VIDEO_DECODE, NULL);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// Child side: runs the records and writes a TraceCall for each to fd
+void HalReplay::replay(FakeTree* tree, int fd)
+{
+    struct power_module* module = &HAL_MODULE_INFO_SYM;
+    LoadTicker ticker;
+    pthread_t thread;
+    bool ticking = false;
+
+    memset(&ticker, 0, sizeof(ticker));
+    ticker.tree = tree;
+    pthread_mutex_init(&ticker.lock, NULL);
+
+    for (size_t i = 0; i < mRecords.size(); i++) {
+        const TraceRecord& r = mRecords[i];
+        const char* args = r.args.c_str();
+        TraceCall call;
+        bool ok = true;
+
+        sleepUntil(mStart + r.ms * 1000000LL);
+        call.record = i;
+        call.start = monotonicNs();
+
+        if (r.op == "prop") {
+            char key[PROPERTY_KEY_MAX], value[PROPERTY_VALUE_MAX];
+
+            ok = sscanf(args, "%31s %91s", key, value) == 2 && !property_set(key, value);
+        } else if (r.op == "init") {
+            module->init(module);
+        } else if (r.op == "interactive") {
+            module->setInteractive(module, atoi(args));
+        } else if (r.op == "hint") {
+            ok = hint(module, args);
+#ifdef ANDROID_API_LP_OR_LATER
+        } else if (r.op == "feature") {
+            char name[32];
+            int state;
+
+            ok = sscanf(args, "%31s %d", name, &state) == 2 && !strcmp(name, "double_tap");
+            if (ok)
+                module->setFeature(module, POWER_FEATURE_DOUBLE_TAP_TO_WAKE, state);
+#endif
+        } else if (r.op == "load") {
+            char cpu[LOAD_CPUS][8];
+            int n = sscanf(args, "%7s %7s %7s %7s", cpu[0], cpu[1], cpu[2], cpu[3]);
+
+            pthread_mutex_lock(&ticker.lock);
+            for (int j = 0; j < LOAD_CPUS; j++)
+                ticker.percent[j] = j < n && strcmp(cpu[j], "-") ? atoi(cpu[j]) : -1;
+            pthread_mutex_unlock(&ticker.lock);
+            if (!ticking)
+                ticking = !pthread_create(&thread, NULL, loadTickerLoop, &ticker);
+        } else if (r.op != "end") {
+            ok = false;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "bad record %d %s %s\n", r.ms, r.op.c_str(), args);
+            _exit(2);
+        }
+
+        call.end = monotonicNs();
+        if (write(fd, &call, sizeof(call)) != sizeof(call))
+            _exit(3);
+    }
+}
+
+bool HalReplay::run(FakeTree* tree)
+{
+    int pipefd[2];
+    TraceCall call;
+    int status;
+    pid_t pid;
+
+    if (pipe(pipefd))
+        return false;
+
+    // Leaves a margin for the fork to the first record
+    mStart = monotonicNs() + 20000000LL;
+    mCalls.clear();
+
+    pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0) {
+        close(pipefd[0]);
+        replay(tree, pipefd[1]);
+        // The HAL threads go with the process
+        _exit(0);
+    }
+
+    close(pipefd[1]);
+    while (read(pipefd[0], &call, sizeof(call)) == sizeof(call))
+        mCalls.push_back(call);
+    close(pipefd[0]);
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "replay exited with status %#x\n", status);
+        return false;
+    }
+
+    return mCalls.size() == mRecords.size();
+}
+
+std::string valueAt(const std::vector<WriteRecord>& records, const std::string& node,
+        int64_t t)
+{
+    std::string value = "unset";
+
+    for (size_t i = 0; i < records.size() && records[i].time <= t; i++) {
+        if (records[i].node == node)
+            value = records[i].released ? "released" : records[i].value;
+    }
+
+    return value;
+}
+
+std::map<std::string, int64_t> residency(const std::vector<WriteRecord>& records,
+        const std::string& node, int64_t start, int64_t end)
+{
+    std::map<std::string, int64_t> held;
+    std::string value = "released";
+    int64_t since = start;
+
+    for (size_t i = 0; i < records.size(); i++) {
+        const WriteRecord& r = records[i];
+
+        if (r.node != node)
+            continue;
+        if (r.time > since && r.time <= end) {
+            held[value] += r.time - since;
+            since = r.time;
+        }
+        value = r.released ? "released" : r.value;
+    }
+    if (end > since)
+        held[value] += end - since;
+
+    return held;
+}
+
+std::vector<Interval> heldIntervals(const std::vector<WriteRecord>& records,
+        const std::string& node, int64_t end, int atLeast)
+{
+    std::vector<Interval> held;
+    int64_t since = -1;
+
+    for (size_t i = 0; i < records.size(); i++) {
+        bool holds;
+
+        if (records[i].node != node)
+            continue;
+        holds = !records[i].released && atoi(records[i].value.c_str()) >= atLeast;
+        if (!holds && since >= 0) {
+            held.push_back(Interval(since, records[i].time));
+            since = -1;
+        } else if (holds && since < 0) {
+            since = records[i].time;
+        }
+    }
+    if (since >= 0)
+        held.push_back(Interval(since, end));
+
+    return held;
+}
+
+int64_t totalLength(const std::vector<Interval>& v)
+{
+    int64_t total = 0;
+
+    for (size_t i = 0; i < v.size(); i++)
+        total += v[i].second - v[i].first;
+    return total;
+}
+
+std::vector<Interval> merged(std::vector<Interval> v)
+{
+    std::vector<Interval> out;
+
+    std::sort(v.begin(), v.end());
+    for (size_t i = 0; i < v.size(); i++) {
+        if (!out.empty() && v[i].first <= out.back().second) {
+            if (v[i].second > out.back().second)
+                out.back().second = v[i].second;
+        } else {
+            out.push_back(v[i]);
+        }
+    }
+    return out;
+}
+
+int64_t overlap(const std::vector<Interval>& a, const std::vector<Interval>& b)
+{
+    int64_t total = 0;
+
+    for (size_t i = 0; i < a.size(); i++) {
+        for (size_t j = 0; j < b.size(); j++) {
+            int64_t start = a[i].first > b[j].first ? a[i].first : b[j].first;
+            int64_t end = a[i].second < b[j].second ? a[i].second : b[j].second;
+
+            if (end > start)
+                total += end - start;
+        }
+    }
+    return total;
+}
+
+void HalReplayTest::SetUp()
+{
+    const char* dir = getenv("POWER_TRACE_DIR");
+
+    mPath = std::string(dir ? dir : POWER_TRACE_DIR) + "/" + GetParam() + ".txt";
+    ASSERT_TRUE(mReplay.load(mPath.c_str())) << mPath;
+    ASSERT_TRUE(mTree.createGrouper());
+    ASSERT_TRUE(mRecorder.start(mTree));
+}
+
+void HalReplayTest::TearDown()
+{
+    if (!HasFailure())
+        return;
+
+    for (size_t i = 0; i < mRecords.size(); i++) {
+        printf("  %8.2f ms %s %s\n", (mRecords[i].time - mReplay.startNs()) / 1e6,
+               mRecords[i].node.c_str(),
+               mRecords[i].released ? "released" : mRecords[i].value.c_str());
+    }
+}
+
+void HalReplayTest::replay(int settleMs)
+{
+    ASSERT_TRUE(mReplay.run(&mTree));
+    if (settleMs)
+        usleep(settleMs * 1000);
+    ASSERT_TRUE(mRecorder.stop(&mRecords));
+}
+
+void HalReplayTest::expectBudgets(const std::map<std::string, long>& measured)
+{
+    const std::map<std::string, long>& budgets = mReplay.budgets();
+
+    ASSERT_FALSE(budgets.empty()) << mPath << " declares no budget";
+    for (std::map<std::string, long>::const_iterator it = budgets.begin();
+            it != budgets.end(); ++it) {
+        std::map<std::string, long>::const_iterator m = measured.find(it->first);
+
+        if (m == measured.end())
+            ADD_FAILURE() << "unknown budget " << it->first;
+        else if (it->first.compare(0, 4, "min_") == 0)
+            EXPECT_GE(m->second, it->second) << it->first;
+        else
+            EXPECT_LE(m->second, it->second) << it->first;
+    }
+}
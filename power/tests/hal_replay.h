@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef POWER_HAL_TESTS_HAL_REPLAY_H
+#define POWER_HAL_TESTS_HAL_REPLAY_H
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fake_tree.h"
+#include "write_recorder.h"
+
+/*
+ * Hint traces replayed through HAL_MODULE_INFO_SYM, one record a line:
+ *   <ms> prop <key> <value>          property_set(), before init
+ *   <ms> init
+ *   <ms> interactive <0|1>
+ *   <ms> hint vsync <0|1>
+ *   <ms> hint interaction [<duration ms>]
+ *   <ms> hint launch [<package>]      POWER_HINT_LAUNCH_BOOST
+ *   <ms> hint low_power|sustained <0|1>
+ *   <ms> hint video_encode|video_decode
+ *   <ms> feature double_tap <0|1>
+ *   <ms> load <busy %|-> x4           /proc/stat advanced every 10 ms at
+ *                                     that load from then on, - offline
+ *   <ms> end
+ * ms counts from the start of the replay. The header may declare
+ *   # budget <name> <value>
+ *   # expect <ms> <node> <value|released|unset>
+ * the value of a node at ms into the replay.
+ *
+ * The HAL keeps its state in globals set up once, each replay runs it
+ * in a child process of its own against the tree.
+ */
+struct TraceRecord {
+    int ms;
+    std::string op;
+    std::string args;
+};
+
+struct TraceExpect {
+    int ms;
+    std::string node;
+    std::string value;
+};
+
+struct TraceCall {
+    int record;
+    int64_t start;
+    int64_t end;
+};
+
+class HalReplay {
+public:
+    HalReplay();
+
+    bool load(const char* path);
+    // Runs the records in a child process. The caller must not have
+    // threads of its own when forking, record with a RecorderProcess.
+    bool run(FakeTree* tree);
+
+    const std::vector<TraceRecord>& records() const { return mRecords; }
+    const std::map<std::string, long>& budgets() const { return mBudgets; }
+    const std::vector<TraceExpect>& expects() const { return mExpects; }
+    const std::vector<TraceCall>& calls() const { return mCalls; }
+    int64_t startNs() const { return mStart; }
+
+private:
+    void replay(FakeTree* tree, int fd);
+
+    std::vector<TraceRecord> mRecords;
+    std::map<std::string, long> mBudgets;
+    std::vector<TraceExpect> mExpects;
+    std::vector<TraceCall> mCalls;
+    int64_t mStart;
+};
+
+// Value of node at time t: the last write before it, "released" for a
+// released PM QoS node and "unset" before any write
+std::string valueAt(const std::vector<WriteRecord>& records, const std::string& node,
+        int64_t t);
+
+// Time a PM QoS node spent at each value between start and end, in ns
+std::map<std::string, int64_t> residency(const std::vector<WriteRecord>& records,
+        const std::string& node, int64_t start, int64_t end);
+
+// [start, end) in ns
+typedef std::pair<int64_t, int64_t> Interval;
+
+// Intervals a PM QoS node was held at atLeast or more, one still held
+// ends at end
+std::vector<Interval> heldIntervals(const std::vector<WriteRecord>& records,
+        const std::string& node, int64_t end, int atLeast = 0);
+int64_t totalLength(const std::vector<Interval>& v);
+// Sorted, overlapping intervals joined
+std::vector<Interval> merged(std::vector<Interval> v);
+// Time in both, intervals of each side must not overlap each other
+int64_t overlap(const std::vector<Interval>& a, const std::vector<Interval>& b);
+
+/*
+ * Fixture of the tests replaying tests/traces/<GetParam()>.txt, or
+ * $POWER_TRACE_DIR, on a fresh grouper tree with a RecorderProcess
+ * started. Tests may add nodes to mTree before replay(). The records
+ * are printed when the test failed.
+ */
+class HalReplayTest : public ::testing::TestWithParam<const char*> {
+protected:
+    virtual void SetUp();
+    virtual void TearDown();
+
+    // Replays the trace, waits settleMs for the last writes, then stops
+    // the recorder into mRecords
+    void replay(int settleMs = 0);
+    // Checks each budget of the trace against the value measured under
+    // its name: min_ budgets are lower bounds, the others upper bounds
+    void expectBudgets(const std::map<std::string, long>& measured);
+
+    std::string mPath;
+    FakeTree mTree;
+    RecorderProcess mRecorder;
+    HalReplay mReplay;
+    std::vector<WriteRecord> mRecords;
+};
+
+#endif
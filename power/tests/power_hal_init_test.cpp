@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Opens and initialises the HAL from several threads at once, the way
+ * binder threads may, and checks that it starts a single TimeoutPoker
+ * thread. The HAL runs in a child process, its state is set up once.
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <hardware/hardware.h>
+#include <hardware/power.h>
+#include <cutils/properties.h>
+
+#include <gtest/gtest.h>
+
+#include "fake_tree.h"
+#include "../powerhal.h"
+
+#define CALLER_THREADS 4
+// Lets a thread started on the side of a call show up
+#define SETTLE_MS 100
+
+extern struct power_module HAL_MODULE_INFO_SYM;
+
+namespace {
+
+int countThreads()
+{
+    DIR *dir = opendir("/proc/self/task");
+    struct dirent *e;
+    int count = 0;
+
+    if (!dir)
+        return -1;
+    while ((e = readdir(dir)) != NULL) {
+        if (e->d_name[0] != '.')
+            count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+void *openAndHint(void *arg)
+{
+    struct power_module *module = &HAL_MODULE_INFO_SYM;
+    hw_device_t *device = NULL;
+
+    (void)arg;
+    if (module->common.methods->open(&module->common, POWER_HARDWARE_MODULE_ID, &device))
+        return (void *)1;
+    module->init(module);
+    module->powerHint(module, POWER_HINT_INTERACTION, NULL);
+    module->setInteractive(module, 1);
+    return NULL;
+}
+
+// Child side: threads before and after the HAL came up, to fd
+void runHal(int fd)
+{
+    pthread_t threads[CALLER_THREADS];
+    int counts[2];
+
+    property_set("sys.boot_completed", "1");
+    // The input monitor is the one other thread the HAL may start
+    property_set(INPUT_BOOST_PROP, "0");
+
+    counts[0] = countThreads();
+    for (int i = 0; i < CALLER_THREADS; i++) {
+        if (pthread_create(&threads[i], NULL, openAndHint, NULL))
+            _exit(1);
+    }
+    for (int i = 0; i < CALLER_THREADS; i++) {
+        void *ret;
+
+        pthread_join(threads[i], &ret);
+        if (ret)
+            _exit(1);
+    }
+    usleep(SETTLE_MS * 1000);
+    counts[1] = countThreads();
+
+    if (write(fd, counts, sizeof(counts)) != sizeof(counts))
+        _exit(1);
+}
+
+TEST(PowerHalInit, SinglePokerThread)
+{
+    FakeTree tree;
+    int pipefd[2], counts[2], status;
+    pid_t pid;
+
+    ASSERT_TRUE(tree.createGrouper());
+    ASSERT_EQ(0, pipe(pipefd));
+
+    pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        close(pipefd[0]);
+        runHal(pipefd[1]);
+        _exit(0);
+    }
+
+    close(pipefd[1]);
+    ASSERT_EQ((ssize_t)sizeof(counts), read(pipefd[0], counts, sizeof(counts)));
+    close(pipefd[0]);
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status) && !WEXITSTATUS(status));
+
+    EXPECT_EQ(counts[0] + 1, counts[1]) << "threads before " << counts[0]
+            << ", after " << counts[1];
+}
+
+} // namespace
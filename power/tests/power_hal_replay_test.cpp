@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays the hint traces of tests/traces through the HAL against a fake
+ * grouper tree and checks the constraint timeline each trace expects,
+ * and its budgets:
+ *   decision_latency_ms  slowest call to its first write, over the calls
+ *                        followed by one within DECISION_WINDOW_MS
+ *   pm_qos_writes        values written and releases on PM QoS nodes
+ */
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "hal_replay.h"
+
+// Later writes are expiries or the work of a periodic task
+#define DECISION_WINDOW_MS 50
+
+namespace {
+
+typedef HalReplayTest PowerTraceReplay;
+
+bool isPmQosNode(const FakeTree &tree, const std::string &node)
+{
+    const std::vector<std::string> &nodes = tree.pmQosNodes();
+
+    return std::find(nodes.begin(), nodes.end(), node) != nodes.end();
+}
+
+TEST_P(PowerTraceReplay, Timeline)
+{
+    // Lets the last expiries land
+    replay(100);
+    if (HasFatalFailure())
+        return;
+
+    const std::vector<WriteRecord> &records = mRecords;
+    const std::vector<TraceCall> &calls = mReplay.calls();
+    std::vector<int64_t> latencies;
+    long pmQosWrites = 0;
+
+    // A call decided something if a write followed before the next call
+    for (size_t i = 0; i < calls.size(); i++) {
+        const std::string &op = mReplay.records()[calls[i].record].op;
+        int64_t next = calls[i].start + DECISION_WINDOW_MS * 1000000LL;
+
+        if (i + 1 < calls.size())
+            next = std::min(next, calls[i + 1].start);
+        if (op == "prop" || op == "load" || op == "end")
+            continue;
+        for (size_t j = 0; j < records.size(); j++) {
+            if (records[j].time >= calls[i].start && records[j].time < next) {
+                latencies.push_back(records[j].time - calls[i].start);
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < records.size(); i++) {
+        if (isPmQosNode(mTree, records[i].node) && records[i].time >= mReplay.startNs())
+            pmQosWrites++;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("%s: %zu calls, %zu decided, latency p50 %.2f ms max %.2f ms, "
+           "%ld PM QoS writes\n", GetParam(), calls.size(), latencies.size(),
+           latencies.empty() ? 0 : latencies[latencies.size() / 2] / 1e6,
+           latencies.empty() ? 0 : latencies.back() / 1e6, pmQosWrites);
+
+    for (size_t i = 0; i < mReplay.expects().size(); i++) {
+        const TraceExpect &e = mReplay.expects()[i];
+
+        EXPECT_EQ(e.value, valueAt(records, e.node, mReplay.startNs() + e.ms * 1000000LL))
+                << e.node << " at " << e.ms << " ms";
+    }
+
+    std::map<std::string, long> measured;
+    measured["pm_qos_writes"] = pmQosWrites;
+    // Rounded up, as good as comparing in ns
+    if (!latencies.empty())
+        measured["decision_latency_ms"] = (latencies.back() + 999999) / 1000000;
+    expectBudgets(measured);
+}
+
+INSTANTIATE_TEST_CASE_P(Traces, PowerTraceReplay,
+        ::testing::Values("boot", "screen", "interaction", "launch", "vsync"));
+
+} // namespace
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays the touch sessions of tests/traces and compares the graded
+ * interaction boosts with a flat one, max frequency for 100 ms on each
+ * interaction hint outside the rate limit:
+ *   max_energy_percent   boost energy of tegra3_model.h, in percent of
+ *                        the flat boost over the same session
+ *   min_covered_percent  time each interaction expects to animate, its
+ *                        duration or 100 ms for a tap, under a floor of
+ *                        at least ANIMATION_FREQ
+ * Animation time left without that floor stands for the latency lost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "hal_replay.h"
+#include "tegra3_model.h"
+
+// grouper max_frequency and animation_boost_frequency
+#define MAX_FREQ 1300000
+#define ANIMATION_FREQ 1000000
+// Duration and rate limit of the INTERACTION profile
+#define FLAT_BOOST_MS 100
+
+namespace {
+
+typedef HalReplayTest PowerInteractionSim;
+
+TEST_P(PowerInteractionSim, GradedBoost)
+{
+    replay();
+    if (HasFatalFailure())
+        return;
+
+    const std::vector<TraceRecord> &trace = mReplay.records();
+    const std::vector<TraceCall> &calls = mReplay.calls();
+    int64_t start = mReplay.startNs();
+    int64_t end = calls.back().start;
+    std::vector<Interval> demand, flat, graded;
+    int64_t flatEnd = 0;
+    int interactions = 0;
+
+    for (size_t i = 0; i < calls.size(); i++) {
+        const TraceRecord &r = trace[calls[i].record];
+        int64_t t = calls[i].start;
+        int duration = 0;
+
+        if (r.op != "hint" || r.args.compare(0, 11, "interaction"))
+            continue;
+        sscanf(r.args.c_str(), "interaction %d", &duration);
+        interactions++;
+        if (duration < FLAT_BOOST_MS)
+            duration = FLAT_BOOST_MS;
+        demand.push_back(Interval(t, t + duration * 1000000LL));
+
+        // Dropped by the rate limit while the last flat boost runs
+        if (t >= flatEnd) {
+            flatEnd = t + FLAT_BOOST_MS * 1000000LL;
+            flat.push_back(Interval(t, flatEnd));
+        }
+    }
+    ASSERT_GT(interactions, 0) << mPath << " has no interaction";
+    demand = merged(demand);
+    graded = heldIntervals(mRecords, "/dev/cpu_freq_min", end, ANIMATION_FREQ);
+
+    double gradedEnergy = boostEnergy(mRecords, start, end);
+    double flatEnergy = cpuPower(MAX_FREQ, 1) * totalLength(flat);
+    long energyPercent = (long)(gradedEnergy * 100 / flatEnergy);
+    long coveredPercent = overlap(graded, demand) * 100 / totalLength(demand);
+    long flatCoveredPercent = overlap(flat, demand) * 100 / totalLength(demand);
+
+    printf("%s: %d interactions, energy %.0f vs %.0f flat (%ld%%), "
+           "animation covered %ld%% vs %ld%% flat\n", GetParam(), interactions,
+           gradedEnergy / 1e6, flatEnergy / 1e6, energyPercent, coveredPercent,
+           flatCoveredPercent);
+
+    std::map<std::string, long> measured;
+    measured["max_energy_percent"] = energyPercent;
+    measured["min_covered_percent"] = coveredPercent;
+    expectBudgets(measured);
+}
+
+INSTANTIATE_TEST_CASE_P(Traces, PowerInteractionSim,
+        ::testing::Values("touch_taps", "touch_scroll"));
+
+} // namespace
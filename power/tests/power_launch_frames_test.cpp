@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays tests/traces/launch_frames.txt with the launch profile of
+ * power_profiles.conf, and models the frames the launch draws from the
+ * cpu and gpu floors the HAL held, then from the cpu floor alone:
+ *   max_janky_percent  frames over a vsync period with the gpu floor
+ * The gpu floor must not make the frames slower either.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "bench_counters.h"
+#include "hal_replay.h"
+#include "tegra3_model.h"
+#include "../powerhal.h"
+
+// Launch line of power_profiles.conf
+#define LAUNCH_PROFILE "launch max 4 2000 2000 416000 0\n"
+#define FRAME_WINDOW_MS 1500
+#define VSYNC_US 16667
+
+namespace {
+
+struct FrameStats {
+    std::vector<int64_t> frameUs;
+    int janky;
+};
+
+// Frames drawn back to back from start, each at the floors of its start
+void modelFrames(const std::vector<WriteRecord> &records, int64_t start, bool gpuFloor,
+        FrameStats *stats)
+{
+    int64_t t = start;
+
+    stats->janky = 0;
+    while (t < start + FRAME_WINDOW_MS * 1000000LL) {
+        int cpu = atoi(valueAt(records, "/dev/cpu_freq_min", t).c_str());
+        int gpu = gpuFloor ? atoi(valueAt(records, "/dev/gpu_freq_min", t).c_str()) : 0;
+        int64_t us = (int64_t)(launchFrameMs(cpu, gpu) * 1000);
+
+        stats->frameUs.push_back(us);
+        if (us > VSYNC_US)
+            stats->janky++;
+        // The next frame starts on the vsync after this one is done
+        t += (us + VSYNC_US - 1) / VSYNC_US * VSYNC_US * 1000LL;
+    }
+}
+
+typedef HalReplayTest PowerLaunchFrames;
+
+// The gpu floor is held on its own node, the cpu floors do not depend on it
+TEST_P(PowerLaunchFrames, GpuFloor)
+{
+    FrameStats gpu, cpu;
+    int64_t launch = -1;
+
+    ASSERT_TRUE(mTree.addInput(POWER_PROFILES_PATH, LAUNCH_PROFILE));
+    replay();
+    if (HasFatalFailure())
+        return;
+
+    for (size_t i = 0; i < mReplay.calls().size() && launch < 0; i++) {
+        const TraceRecord &r = mReplay.records()[mReplay.calls()[i].record];
+
+        if (r.op == "hint" && r.args.compare(0, 6, "launch") == 0)
+            launch = mReplay.calls()[i].start;
+    }
+    ASSERT_GE(launch, 0) << mPath << " has no launch";
+
+    modelFrames(mRecords, launch, true, &gpu);
+    modelFrames(mRecords, launch, false, &cpu);
+
+    const FrameStats *runs[] = { &cpu, &gpu };
+    const char *names[] = { "cpu floor", "cpu+gpu floor" };
+    for (int i = 0; i < 2; i++) {
+        std::vector<int64_t> us = runs[i]->frameUs;
+
+        printf("%-13s %3zu frames, frame time ms p50 %5.1f p90 %5.1f, %d janky\n",
+               names[i], us.size(), percentile(&us, 50) / 1e3, percentile(&us, 90) / 1e3,
+               runs[i]->janky);
+    }
+
+    std::vector<int64_t> gpuUs = gpu.frameUs, cpuUs = cpu.frameUs;
+    EXPECT_LE(percentile(&gpuUs, 90), percentile(&cpuUs, 90));
+
+    std::map<std::string, long> measured;
+    measured["max_janky_percent"] = gpu.janky * 100 / (long)gpu.frameUs.size();
+    expectBudgets(measured);
+}
+
+INSTANTIATE_TEST_CASE_P(Traces, PowerLaunchFrames, ::testing::Values("launch_frames"));
+
+} // namespace
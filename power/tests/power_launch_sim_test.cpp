@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays the launch traces of tests/traces, whose "load" records keep a
+ * cpu busy for the length of each launch, and compares the learned launch
+ * boosts against the fixed LAUNCH profile:
+ *   max_boost_percent    time /dev/cpu_freq_min was held, in percent of
+ *                        the fixed boost over the same launches
+ *   min_covered_percent  busy time under the boost
+ * Boost time stands for the energy spent, busy time left unboosted for
+ * the latency lost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "hal_replay.h"
+#include "../powerhal.h"
+
+// Duration of the grouper LAUNCH profile
+#define FIXED_BOOST_MS 2000
+
+namespace {
+
+typedef HalReplayTest PowerLaunchSim;
+
+TEST_P(PowerLaunchSim, LearnedBoost)
+{
+    replay();
+    if (HasFatalFailure())
+        return;
+
+    const std::vector<TraceRecord> &trace = mReplay.records();
+    const std::vector<TraceCall> &calls = mReplay.calls();
+    int64_t end = calls.back().start;
+    std::vector<Interval> busy, fixed, boosted;
+    std::string package;
+    int busyMs = 0;
+
+    // Busy from a load record with a cpu over the threshold to the next one
+    for (size_t i = 0; i < calls.size(); i++) {
+        const TraceRecord &r = trace[calls[i].record];
+        int cpu[4] = { 0, 0, 0, 0 };
+
+        if (r.op == "hint" && r.args.compare(0, 7, "launch ") == 0) {
+            int64_t fixedEnd = calls[i].start + FIXED_BOOST_MS * 1000000LL;
+
+            package = r.args.substr(7);
+            fixed.push_back(Interval(calls[i].start, std::min(end, fixedEnd)));
+        }
+        if (r.op != "load" || i + 1 == calls.size())
+            continue;
+        sscanf(r.args.c_str(), "%d %d %d %d", &cpu[0], &cpu[1], &cpu[2], &cpu[3]);
+        if (*std::max_element(cpu, cpu + 4) >= LAUNCH_BUSY_PERCENT) {
+            busy.push_back(Interval(calls[i].start, calls[i + 1].start));
+            busyMs = (calls[i + 1].start - calls[i].start) / 1000000;
+        }
+    }
+    ASSERT_FALSE(busy.empty()) << mPath << " has no busy load";
+    ASSERT_FALSE(fixed.empty()) << mPath << " has no launch";
+
+    boosted = heldIntervals(mRecords, "/dev/cpu_freq_min", end);
+
+    long boostPercent = totalLength(boosted) * 100 / totalLength(fixed);
+    long coveredPercent = overlap(boosted, busy) * 100 / totalLength(busy);
+    long fixedCoveredPercent = overlap(fixed, busy) * 100 / totalLength(busy);
+
+    printf("%s: %zu launches, boost %lld ms vs %lld ms fixed (%ld%%), "
+           "busy covered %ld%% vs %ld%% fixed\n", GetParam(), fixed.size(),
+           (long long)(totalLength(boosted) / 1000000),
+           (long long)(totalLength(fixed) / 1000000),
+           boostPercent, coveredPercent, fixedCoveredPercent);
+
+    std::map<std::string, long> measured;
+    measured["max_boost_percent"] = boostPercent;
+    measured["min_covered_percent"] = coveredPercent;
+    expectBudgets(measured);
+
+    // Saved on screen off, the last busy sample is at most one period late
+    FILE *f = fopen(mTree.path(LAUNCH_HISTORY_PATH).c_str(), "r");
+    char name[APP_PACKAGE_MAX];
+    int duration = 0;
+    bool found = false;
+
+    ASSERT_TRUE(f != NULL) << LAUNCH_HISTORY_PATH << " not saved";
+    while (!found && fscanf(f, "%95s %d", name, &duration) == 2)
+        found = package == name;
+    fclose(f);
+    ASSERT_TRUE(found) << package << " not in " << LAUNCH_HISTORY_PATH;
+    EXPECT_GE(duration, busyMs - LAUNCH_SAMPLE_MS);
+    EXPECT_LE(duration, busyMs + LAUNCH_SAMPLE_MS);
+}
+
+INSTANTIATE_TEST_CASE_P(Traces, PowerLaunchSim,
+        ::testing::Values("launch_short", "launch_long"));
+
+} // namespace
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Calls powerHint() of HAL_MODULE_INFO_SYM from several threads against
+ * the stub nodes of a fake grouper tree, see tests/fake_tree.h, and
+ * reports the latency from the hint to the value showing on
+ * /dev/cpu_freq_min, with what each hint costs.
+ *
+ *   powerhal_benchmark [-t threads[,threads...]] [-r hints/s] [-d seconds]
+ *
+ * Each thread sends interaction hints at the rate, jittered by half a
+ * period either way: taps, and one in eight a fling of 300 to 600 ms.
+ * Without vsync and launch hints a write raising cpu_freq_min within
+ * APPLY_WINDOW_MS of a hint applies the last hint started before it,
+ * lower values come from boosts expiring. Hints rate limited, or asking
+ * for the value already held, write nothing. Costs are net of an idle
+ * period as long as the run, the HAL samples on its own.
+ * The stats the HAL writes on screen off follow each run.
+ *
+ * Each thread count runs the HAL in a process of its own, the HAL sets
+ * itself up once per process.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <hardware/hardware.h>
+#include <hardware/power.h>
+#include <cutils/properties.h>
+
+#include "bench_counters.h"
+#include "fake_tree.h"
+#include "write_recorder.h"
+#include "../powerhal.h"
+
+#define DEFAULT_RATE_HZ 20
+#define DEFAULT_SECONDS 5
+#define MAX_THREAD_COUNTS 8
+#define FLING_EVERY 8
+#define FLING_MIN_MS 300
+#define FLING_MAX_MS 600
+// A hint is applied by now or was dropped
+#define APPLY_WINDOW_MS 50
+// Lets init and the last writes settle
+#define SETTLE_MS 200
+
+extern struct power_module HAL_MODULE_INFO_SYM;
+
+struct HintThread {
+    pthread_t thread;
+    int rateHz;
+    int64_t end;
+    unsigned int seed;
+    std::vector<int64_t> calls;
+};
+
+// What a run sends back from its process
+struct RunResult {
+    int calls;
+    BenchCounters idle;
+    BenchCounters hints;
+};
+
+static void sleepUntil(int64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+        ;
+}
+
+static void* hintLoop(void* arg)
+{
+    HintThread* t = (HintThread*)arg;
+    struct power_module* module = &HAL_MODULE_INFO_SYM;
+    int64_t period = 1000000000LL / t->rateHz;
+    int64_t next = monotonicNs() + rand_r(&t->seed) % period;
+
+    while (next < t->end) {
+        int duration = 0;
+
+        if (rand_r(&t->seed) % FLING_EVERY == 0)
+            duration = FLING_MIN_MS + rand_r(&t->seed) % (FLING_MAX_MS - FLING_MIN_MS);
+
+        sleepUntil(next);
+        t->calls.push_back(monotonicNs());
+        module->powerHint(module, POWER_HINT_INTERACTION, duration ? &duration : NULL);
+        next += period / 2 + rand_r(&t->seed) % period;
+    }
+
+    return NULL;
+}
+
+// Child side: idles, hints, then writes a RunResult and the call times to fd
+static void runHal(int threads, int rateHz, int seconds, int fd)
+{
+    struct power_module* module = &HAL_MODULE_INFO_SYM;
+    std::vector<HintThread> hinters(threads);
+    std::vector<int64_t> calls;
+    BenchCounters before, after;
+    RunResult result;
+
+    property_set("sys.boot_completed", "1");
+    // Keeps the input monitor out of the idle costs
+    property_set(INPUT_BOOST_PROP, "0");
+    module->init(module);
+    usleep(SETTLE_MS * 1000);
+
+    readBenchCounters(&before);
+    usleep(seconds * 1000000);
+    readBenchCounters(&after);
+    result.idle = benchCountersDelta(before, after);
+
+    for (int i = 0; i < threads; i++) {
+        hinters[i].rateHz = rateHz;
+        hinters[i].seed = i + 1;
+        // Kept out of the allocations counted
+        hinters[i].calls.reserve(rateHz * seconds * 2 + 16);
+    }
+
+    readBenchCounters(&before);
+    for (int i = 0; i < threads; i++) {
+        hinters[i].end = monotonicNs() + seconds * 1000000000LL;
+        if (pthread_create(&hinters[i].thread, NULL, hintLoop, &hinters[i]))
+            _exit(1);
+    }
+    for (int i = 0; i < threads; i++)
+        pthread_join(hinters[i].thread, NULL);
+    readBenchCounters(&after);
+    result.hints = benchCountersDelta(before, after);
+
+    // Queues the write of the stats
+    module->setInteractive(module, 0);
+    usleep(SETTLE_MS * 1000);
+
+    for (int i = 0; i < threads; i++)
+        calls.insert(calls.end(), hinters[i].calls.begin(), hinters[i].calls.end());
+    result.calls = calls.size();
+    if (write(fd, &result, sizeof(result)) != sizeof(result) ||
+            write(fd, &calls[0], calls.size() * sizeof(int64_t)) !=
+                    (ssize_t)(calls.size() * sizeof(int64_t)))
+        _exit(1);
+}
+
+static bool readFully(int fd, void* buf, size_t len)
+{
+    char* p = (char*)buf;
+
+    while (len) {
+        ssize_t n = read(fd, p, len);
+
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static double perHint(int64_t hints, int64_t idle, int calls)
+{
+    if (hints < 0 || idle < 0 || !calls)
+        return -1;
+    return (double)(hints - idle) / calls;
+}
+
+static bool benchmark(int threads, int rateHz, int seconds)
+{
+    std::vector<WriteRecord> records;
+    std::vector<int64_t> calls, latencies;
+    RecorderProcess recorder;
+    FakeTree tree;
+    RunResult result;
+    int pipefd[2], status, held = 0;
+    char line[256];
+    pid_t pid;
+    FILE* f;
+
+    // Both children are forked before any thread runs here
+    if (!tree.createGrouper() || !recorder.start(tree) || pipe(pipefd))
+        return false;
+
+    pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0) {
+        close(pipefd[0]);
+        runHal(threads, rateHz, seconds, pipefd[1]);
+        _exit(0);
+    }
+
+    close(pipefd[1]);
+    if (!readFully(pipefd[0], &result, sizeof(result))) {
+        close(pipefd[0]);
+        waitpid(pid, &status, 0);
+        return false;
+    }
+    calls.resize(result.calls);
+    if (result.calls && !readFully(pipefd[0], &calls[0], calls.size() * sizeof(int64_t)))
+        calls.clear();
+    close(pipefd[0]);
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) ||
+            !recorder.stop(&records))
+        return false;
+
+    std::sort(calls.begin(), calls.end());
+    for (size_t i = 0; i < records.size(); i++) {
+        std::vector<int64_t>::iterator c;
+        int value;
+
+        if (records[i].node != "/dev/cpu_freq_min")
+            continue;
+        value = records[i].released ? 0 : atoi(records[i].value.c_str());
+        c = std::upper_bound(calls.begin(), calls.end(), records[i].time);
+        if (value > held && c != calls.begin() &&
+                records[i].time - *(c - 1) < APPLY_WINDOW_MS * 1000000LL)
+            latencies.push_back(records[i].time - *(c - 1));
+        held = value;
+    }
+
+    printf("%7d %6d %7zu %8.1f %8.1f %8.1f %8.1f %7.2f %8.2f %8.2f\n",
+           threads, result.calls, latencies.size(),
+           percentile(&latencies, 50) / 1e3, percentile(&latencies, 90) / 1e3,
+           percentile(&latencies, 99) / 1e3, percentile(&latencies, 100) / 1e3,
+           perHint(result.hints.allocs, result.idle.allocs, result.calls),
+           perHint(result.hints.syscalls, result.idle.syscalls, result.calls),
+           perHint(result.hints.switches, result.idle.switches, result.calls));
+
+    f = fopen(tree.path(POWER_STATS_PATH).c_str(), "r");
+    while (f && fgets(line, sizeof(line), f))
+        printf("        %s", line);
+    if (f)
+        fclose(f);
+    fflush(stdout);
+    return true;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-t threads[,threads...]] [-r hints/s] [-d seconds]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    int threads[MAX_THREAD_COUNTS] = { 1, 2, 4 };
+    int counts = 3;
+    int rateHz = DEFAULT_RATE_HZ;
+    int seconds = DEFAULT_SECONDS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:r:d:")) != -1) {
+        switch (opt) {
+        case 't': {
+            char* s = optarg;
+
+            for (counts = 0; counts < MAX_THREAD_COUNTS && *s; counts++) {
+                threads[counts] = strtol(s, &s, 10);
+                if (threads[counts] <= 0 || (*s && *s++ != ',')) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+            break;
+        }
+        case 'r':
+            rateHz = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!counts || rateHz <= 0 || seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("interaction hints at %d/s per thread for %d s\n", rateHz, seconds);
+    printf("threads  hints applied   latency us p50      p90      p99      max"
+           "  allocs syscalls switches (per hint)\n");
+    for (int i = 0; i < counts; i++) {
+        if (!benchmark(threads[i], rateHz, seconds)) {
+            fprintf(stderr, "run with %d threads failed\n", threads[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+
+#include "tegra3_model.h"
+
+// An online core idling next to the busy one, clock gated
+#define IDLE_CORE_SHARE 0.1
+
+// Work of a launch frame, 7 ms of cpu at 1.3 GHz and 13 ms of gpu at
+// 416 MHz
+#define FRAME_CPU_CYCLES 9.0e6
+#define FRAME_GPU_CYCLES 5.5e6
+
+struct OperatingPoint {
+    int freqKhz;
+    int millivolts;
+};
+
+// Approximate T30L cpu rail, lowest voltage per frequency
+static const OperatingPoint sCpuTable[] = {
+    { 204000, 800 },
+    { 340000, 850 },
+    { 475000, 875 },
+    { 640000, 925 },
+    { 760000, 975 },
+    { 860000, 1000 },
+    { 1000000, 1050 },
+    { 1100000, 1100 },
+    { 1200000, 1150 },
+    { 1300000, 1200 },
+};
+
+double cpuPower(int freqKhz, int onlineCpus)
+{
+    const int count = sizeof(sCpuTable) / sizeof(sCpuTable[0]);
+    double volts, power;
+    int i;
+
+    for (i = 0; i < count - 1 && sCpuTable[i].freqKhz < freqKhz; i++)
+        ;
+    volts = sCpuTable[i].millivolts / 1000.0;
+    power = freqKhz / 1e6 * volts * volts;
+
+    if (onlineCpus < 1)
+        onlineCpus = 1;
+    return power * (1 + (onlineCpus - 1) * IDLE_CORE_SHARE);
+}
+
+double boostEnergy(const std::vector<WriteRecord>& records, int64_t start, int64_t end)
+{
+    int64_t since = start;
+    double energy = 0;
+    int freq = 0;
+    int cpus = 1;
+
+    for (size_t i = 0; i <= records.size(); i++) {
+        int64_t t = i < records.size() ? records[i].time : end;
+
+        if (t > end)
+            t = end;
+        if (t > since) {
+            if (freq)
+                energy += cpuPower(freq, cpus) * (t - since);
+            since = t;
+        }
+        if (i == records.size() || t == end)
+            break;
+
+        if (records[i].node == "/dev/cpu_freq_min")
+            freq = records[i].released ? 0 : atoi(records[i].value.c_str());
+        else if (records[i].node == "/dev/min_online_cpus")
+            cpus = records[i].released ? 1 : atoi(records[i].value.c_str());
+    }
+
+    return energy;
+}
+
+double launchFrameMs(int cpuFloorKhz, int gpuFloorKhz)
+{
+    int cpu = cpuFloorKhz > GOVERNOR_CPU_KHZ ? cpuFloorKhz : GOVERNOR_CPU_KHZ;
+    int gpu = gpuFloorKhz > GOVERNOR_GPU_KHZ ? gpuFloorKhz : GOVERNOR_GPU_KHZ;
+    double cpuMs = FRAME_CPU_CYCLES / cpu;
+    double gpuMs = FRAME_GPU_CYCLES / gpu;
+
+    return cpuMs > gpuMs ? cpuMs : gpuMs;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef POWER_HAL_TESTS_TEGRA3_MODEL_H
+#define POWER_HAL_TESTS_TEGRA3_MODEL_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "write_recorder.h"
+
+/*
+ * Coarse model of the grouper Tegra 3 (T30L) for comparing boost
+ * policies with each other. Results are relative units, not mW.
+ *
+ * The power of a cpu floor is f * V^2 of the core running the work,
+ * from an approximate T30L dvfs table, plus IDLE_CORE_SHARE of that for
+ * each other core the boost holds online, clock gated on the same rail.
+ */
+double cpuPower(int freqKhz, int onlineCpus);
+
+// Energy of the floors held on /dev/cpu_freq_min and /dev/min_online_cpus
+// between start and end, in ns * cpuPower(). Time without a frequency
+// floor is left to the governor and not counted.
+double boostEnergy(const std::vector<WriteRecord>& records, int64_t start, int64_t end);
+
+/*
+ * Frame of a rendering bound launch, cpu and gpu work pipelined so the
+ * frame takes the longer of the two. The governors run the cpu and the
+ * gpu at GOVERNOR_CPU_KHZ and GOVERNOR_GPU_KHZ during a launch unless a
+ * floor holds them higher, 0 for no floor.
+ */
+#define GOVERNOR_CPU_KHZ 1000000
+#define GOVERNOR_GPU_KHZ 247000
+double launchFrameMs(int cpuFloorKhz, int gpuFloorKhz);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Drives TimeoutPoker directly on the PM QoS nodes of a fake grouper
+ * tree and reports the latency from requestPmQosTimed() to the value
+ * showing on the node, and what each request costs.
+ *
+ *   timeoutpoker_benchmark [requests per scenario]
+ *
+ *   held  a request every 2 ms for 10 ms, the node stays open
+ *   cold  a request every 20 ms for 5 ms, each opens the node again
+ *
+ * Every request raises the value, the write it caused is found by value.
+ * The counters of the poker itself follow, from TimeoutPoker::dump().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "bench_counters.h"
+#include "fake_tree.h"
+#include "write_recorder.h"
+#include "../timeoutpoker.h"
+
+#define DEFAULT_REQUESTS 200
+// Lets the last writes land before the recorder stops
+#define SETTLE_MS 50
+
+struct Scenario {
+    const char* name;
+    const char* node;
+    int periodMs;
+    int durationMs;
+
+    std::vector<int64_t> calls;
+    BenchCounters cost;
+};
+
+static void sleepUntil(int64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+        ;
+}
+
+static void runScenario(TimeoutPoker* poker, Scenario* s, int requests, int base)
+{
+    BenchCounters before, after;
+    int64_t next = monotonicNs();
+
+    // Kept out of the allocations counted
+    s->calls.reserve(requests);
+    readBenchCounters(&before);
+    for (int i = 0; i < requests; i++) {
+        sleepUntil(next);
+        s->calls.push_back(monotonicNs());
+        poker->requestPmQosTimed(s->node, base + i, ms2ns(s->durationMs));
+        next += s->periodMs * 1000000LL;
+    }
+    readBenchCounters(&after);
+    s->cost = benchCountersDelta(before, after);
+}
+
+static void report(const Scenario& s, const std::vector<WriteRecord>& records, int base)
+{
+    std::vector<int64_t> latencies;
+    int n = s.calls.size();
+    int lost;
+
+    for (size_t i = 0; i < records.size(); i++) {
+        int val;
+
+        if (records[i].node != s.node || records[i].released)
+            continue;
+        val = atoi(records[i].value.c_str()) - base;
+        if (val >= 0 && val < n)
+            latencies.push_back(records[i].time - s.calls[val]);
+    }
+    lost = n - latencies.size();
+
+    printf("%-5s %5d requests  latency us p50 %6.1f p90 %6.1f p99 %6.1f max %7.1f"
+           "  %d unseen\n", s.name, n,
+           percentile(&latencies, 50) / 1e3, percentile(&latencies, 90) / 1e3,
+           percentile(&latencies, 99) / 1e3, percentile(&latencies, 100) / 1e3, lost);
+    printf("      per request: %.2f allocs, %.2f rw syscalls, %.2f context switches\n",
+           (double)s.cost.allocs / n,
+           s.cost.syscalls < 0 ? -1.0 : (double)s.cost.syscalls / n,
+           (double)s.cost.switches / n);
+}
+
+int main(int argc, char** argv)
+{
+    int requests = argc > 1 ? atoi(argv[1]) : DEFAULT_REQUESTS;
+    Scenario scenarios[] = {
+        { "held", "/dev/cpu_freq_min", 2, 10, std::vector<int64_t>(), BenchCounters() },
+        { "cold", "/dev/gpu_freq_min", 20, 5, std::vector<int64_t>(), BenchCounters() },
+    };
+    const int count = sizeof(scenarios) / sizeof(scenarios[0]);
+    std::vector<WriteRecord> records;
+    RecorderProcess recorder;
+    FakeTree tree;
+    Barrier readyToRun;
+    TimeoutPoker* poker;
+
+    if (requests <= 0) {
+        fprintf(stderr, "usage: %s [requests per scenario]\n", argv[0]);
+        return 1;
+    }
+
+    // The recorder forks, before the poker starts its thread
+    if (!tree.createGrouper() || !recorder.start(tree)) {
+        fprintf(stderr, "could not set up the fake tree under %s\n", tree.root());
+        return 1;
+    }
+
+    poker = new TimeoutPoker(&readyToRun);
+    readyToRun.wait();
+
+    for (int i = 0; i < count; i++)
+        runScenario(poker, &scenarios[i], requests, (i + 1) * 1000000);
+    usleep(SETTLE_MS * 1000);
+
+    if (!recorder.stop(&records)) {
+        fprintf(stderr, "recorder failed\n");
+        return 1;
+    }
+    for (int i = 0; i < count; i++)
+        report(scenarios[i], records, (i + 1) * 1000000);
+
+    printf("\npoker counters:\n");
+    fflush(stdout);
+    poker->dump(STDOUT_FILENO);
+
+    return 0;
+}
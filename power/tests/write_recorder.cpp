@@ -0,0 +1,373 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "write_recorder.h"
+
+#define MAX_EVENTS 16
+#define VALUE_MAX 128
+
+// epoll tags, FIFOs are tagged with their index
+#define TAG_STOP 0xffffffffu
+#define TAG_INOTIFY 0xfffffffeu
+
+int64_t monotonicNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+WriteRecorder::WriteRecorder() :
+    mTree(NULL),
+    mEpollFd(-1),
+    mInotifyFd(-1),
+    mStopFd(-1),
+    mRunning(false)
+{
+    pthread_mutex_init(&mLock, NULL);
+}
+
+WriteRecorder::~WriteRecorder()
+{
+    stop();
+    for (size_t i = 0; i < mFifos.size(); i++) {
+        if (mFifos[i].fd >= 0)
+            close(mFifos[i].fd);
+    }
+    if (mInotifyFd >= 0)
+        close(mInotifyFd);
+    if (mStopFd >= 0)
+        close(mStopFd);
+    if (mEpollFd >= 0)
+        close(mEpollFd);
+    pthread_mutex_destroy(&mLock);
+}
+
+// Non-blocking read end, it only reports a hangup once a writer came and left
+bool WriteRecorder::openFifo(Fifo* f)
+{
+    struct epoll_event ev;
+
+    f->fd = open(f->path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (f->fd < 0) {
+        fprintf(stderr, "open %s: %s\n", f->path.c_str(), strerror(errno));
+        return false;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = f - &mFifos[0];
+    return !epoll_ctl(mEpollFd, EPOLL_CTL_ADD, f->fd, &ev);
+}
+
+bool WriteRecorder::start(const FakeTree& tree)
+{
+    struct epoll_event ev;
+
+    mTree = &tree;
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    mStopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (mEpollFd < 0 || mInotifyFd < 0 || mStopFd < 0)
+        return false;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = TAG_STOP;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mStopFd, &ev))
+        return false;
+    ev.data.u32 = TAG_INOTIFY;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mInotifyFd, &ev))
+        return false;
+
+    for (size_t i = 0; i < tree.outputs().size(); i++) {
+        const std::string& node = tree.outputs()[i];
+        int wd = inotify_add_watch(mInotifyFd, tree.path(node.c_str()).c_str(), IN_MODIFY);
+
+        if (wd < 0)
+            return false;
+        mWatches[wd] = node;
+    }
+
+    // Sized first, openFifo() tags entries by their index
+    mFifos.resize(tree.pmQosNodes().size());
+    for (size_t i = 0; i < mFifos.size(); i++) {
+        mFifos[i].node = tree.pmQosNodes()[i];
+        mFifos[i].path = tree.path(mFifos[i].node.c_str());
+        if (!openFifo(&mFifos[i]))
+            return false;
+    }
+
+    if (pthread_create(&mThread, NULL, threadLoop, this))
+        return false;
+    mRunning = true;
+    return true;
+}
+
+void WriteRecorder::stop()
+{
+    uint64_t one = 1;
+
+    if (!mRunning)
+        return;
+
+    write(mStopFd, &one, sizeof(one));
+    pthread_join(mThread, NULL);
+    mRunning = false;
+}
+
+std::vector<WriteRecord> WriteRecorder::records() const
+{
+    std::vector<WriteRecord> copy;
+
+    pthread_mutex_lock(&mLock);
+    copy = mRecords;
+    pthread_mutex_unlock(&mLock);
+    return copy;
+}
+
+void WriteRecorder::add(const std::string& node, const std::string& value, bool released)
+{
+    WriteRecord r;
+
+    r.time = monotonicNs();
+    r.node = node;
+    r.value = value;
+    r.released = released;
+    pthread_mutex_lock(&mLock);
+    mRecords.push_back(r);
+    pthread_mutex_unlock(&mLock);
+}
+
+void WriteRecorder::readFifo(Fifo* f, bool hangup)
+{
+    char buf[256];
+    ssize_t len;
+
+    while ((len = read(f->fd, buf, sizeof(buf))) > 0)
+        f->pending.append(buf, len);
+
+    // PM QoS values are written as native ints
+    while (f->pending.size() >= sizeof(int)) {
+        int val;
+
+        memcpy(&val, f->pending.data(), sizeof(val));
+        f->pending.erase(0, sizeof(val));
+        snprintf(buf, sizeof(buf), "%d", val);
+        add(f->node, buf, false);
+    }
+
+    if (!hangup)
+        return;
+
+    // Every holder closed the node, start over for the next one
+    add(f->node, "", true);
+    f->pending.clear();
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, f->fd, NULL);
+    close(f->fd);
+    openFifo(f);
+}
+
+void WriteRecorder::readOutput(int wd)
+{
+    std::map<int, std::string>::const_iterator it = mWatches.find(wd);
+    char buf[VALUE_MAX];
+    std::string path;
+    ssize_t len;
+    int fd;
+
+    if (it == mWatches.end())
+        return;
+
+    path = mTree->path(it->second.c_str());
+    fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    // Our own truncation shows up as an empty write
+    if (len > 0) {
+        buf[len] = '\0';
+        buf[strcspn(buf, "\n")] = '\0';
+        add(it->second, buf, false);
+        ftruncate(fd, 0);
+    }
+    close(fd);
+}
+
+void* WriteRecorder::threadLoop(void* arg)
+{
+    ((WriteRecorder*)arg)->run();
+    return NULL;
+}
+
+void WriteRecorder::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+    bool stopping = false;
+
+    for (;;) {
+        // Once stopping, only drain what is already there
+        int n = epoll_wait(mEpollFd, events, MAX_EVENTS, stopping ? 0 : -1);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0 && stopping)
+            break;
+
+        for (int i = 0; i < n; i++) {
+            uint32_t tag = events[i].data.u32;
+
+            if (tag == TAG_STOP) {
+                uint64_t count;
+
+                read(mStopFd, &count, sizeof(count));
+                stopping = true;
+            } else if (tag == TAG_INOTIFY) {
+                char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+                ssize_t len;
+
+                while ((len = read(mInotifyFd, buf, sizeof(buf))) > 0) {
+                    for (char* p = buf; p < buf + len; ) {
+                        const struct inotify_event* e = (const struct inotify_event*)p;
+
+                        readOutput(e->wd);
+                        p += sizeof(*e) + e->len;
+                    }
+                }
+            } else if (tag < mFifos.size()) {
+                readFifo(&mFifos[tag], events[i].events & (EPOLLHUP | EPOLLERR));
+            }
+        }
+    }
+}
+
+RecorderProcess::RecorderProcess() :
+    mPid(-1),
+    mControlFd(-1),
+    mRecordsFd(-1)
+{
+}
+
+RecorderProcess::~RecorderProcess()
+{
+    stop(NULL);
+}
+
+// Child side: records until the control pipe closes, then writes the
+// records as "<time> <released> <node> <value>" lines
+static void recordUntilClosed(const FakeTree& tree, int controlFd, int recordsFd)
+{
+    WriteRecorder recorder;
+    char c = 0;
+    FILE* out;
+
+    if (!recorder.start(tree) || write(recordsFd, &c, 1) != 1)
+        _exit(1);
+    while (read(controlFd, &c, 1) > 0)
+        ;
+    recorder.stop();
+
+    out = fdopen(recordsFd, "w");
+    if (!out)
+        _exit(1);
+    const std::vector<WriteRecord> records = recorder.records();
+    for (size_t i = 0; i < records.size(); i++) {
+        fprintf(out, "%lld %d %s %s\n", (long long)records[i].time, records[i].released,
+                records[i].node.c_str(), records[i].value.c_str());
+    }
+    fclose(out);
+}
+
+bool RecorderProcess::start(const FakeTree& tree)
+{
+    int control[2], records[2];
+    char c;
+
+    if (pipe(control))
+        return false;
+    if (pipe(records)) {
+        close(control[0]);
+        close(control[1]);
+        return false;
+    }
+
+    mPid = fork();
+    if (mPid == 0) {
+        close(control[1]);
+        close(records[0]);
+        recordUntilClosed(tree, control[0], records[1]);
+        // Not returning into the caller, whose tree this is
+        _exit(0);
+    }
+
+    close(control[0]);
+    close(records[1]);
+    mControlFd = control[1];
+    mRecordsFd = records[0];
+    return mPid > 0 && read(mRecordsFd, &c, 1) == 1;
+}
+
+bool RecorderProcess::stop(std::vector<WriteRecord>* records)
+{
+    char line[512];
+    int status = 0;
+    FILE* in;
+
+    if (mPid <= 0)
+        return false;
+
+    close(mControlFd);
+    in = fdopen(mRecordsFd, "r");
+    while (in && fgets(line, sizeof(line), in)) {
+        WriteRecord r;
+        char node[256];
+        long long time;
+        int released, value;
+
+        line[strcspn(line, "\n")] = '\0';
+        value = strlen(line);
+        if (sscanf(line, "%lld %d %255s %n", &time, &released, node, &value) < 3)
+            continue;
+        r.time = time;
+        r.released = released;
+        r.node = node;
+        r.value = line + value;
+        if (records)
+            records->push_back(r);
+    }
+    if (in)
+        fclose(in);
+    else
+        close(mRecordsFd);
+
+    waitpid(mPid, &status, 0);
+    mPid = -1;
+    return WIFEXITED(status) && !WEXITSTATUS(status);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef POWER_HAL_TESTS_WRITE_RECORDER_H
+#define POWER_HAL_TESTS_WRITE_RECORDER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "fake_tree.h"
+
+// CLOCK_MONOTONIC, comparable across processes
+int64_t monotonicNs();
+
+struct WriteRecord {
+    int64_t time;
+    std::string node;
+    // What was written, PM QoS values as decimal ints
+    std::string value;
+    // The PM QoS node was closed by its last holder
+    bool released;
+};
+
+/*
+ * Timestamps every value the HAL writes to the outputs and PM QoS nodes
+ * of a FakeTree, from a thread of its own.
+ *
+ * Times are when the recorder read the value, an upper bound of when
+ * it was written, a few tens of us late on an idle host. Outputs are
+ * truncated once read so that the next write at offset 0 reads back
+ * whole. A PM QoS node released and opened again before the recorder
+ * ran only shows the new value.
+ */
+class WriteRecorder {
+public:
+    WriteRecorder();
+    ~WriteRecorder();
+
+    bool start(const FakeTree& tree);
+    // Drains what is pending, then stops
+    void stop();
+
+    std::vector<WriteRecord> records() const;
+
+private:
+    struct Fifo {
+        std::string node;
+        std::string path;
+        int fd;
+        std::string pending;
+    };
+
+    static void* threadLoop(void* arg);
+    void run();
+    bool openFifo(Fifo* f);
+    void readFifo(Fifo* f, bool hangup);
+    void readOutput(int wd);
+    void add(const std::string& node, const std::string& value, bool released);
+
+    const FakeTree* mTree;
+    int mEpollFd;
+    int mInotifyFd;
+    int mStopFd;
+    bool mRunning;
+    pthread_t mThread;
+    std::vector<Fifo> mFifos;
+    std::map<int, std::string> mWatches;
+
+    mutable pthread_mutex_t mLock;
+    std::vector<WriteRecord> mRecords;
+};
+
+/*
+ * WriteRecorder in a child process, which keeps its reads out of the
+ * counters of a benchmark driving the HAL in process. Started before
+ * the caller spawns threads.
+ */
+class RecorderProcess {
+public:
+    RecorderProcess();
+    ~RecorderProcess();
+
+    // Returns once the child holds the nodes open
+    bool start(const FakeTree& tree);
+    // Drains and stops the child, returns what it recorded
+    bool stop(std::vector<WriteRecord>* records);
+
+private:
+    pid_t mPid;
+    int mControlFd;
+    int mRecordsFd;
+};
+
+#endif
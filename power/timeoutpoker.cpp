@@ -8,28 +8,85 @@
  * is strictly prohibited.
  */
 #include "timeoutpoker.h"
+#include "powerhal_utils.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #undef LOG_TAG
 #define LOG_TAG "powerHAL::TimeoutPoker"
 
+#define MAX_EPOLL_EVENTS 8
+
 enum {
     CLIENT_FD,
     SERVER_FD
 };
 
+// Ceiling nodes, the lowest request wins. All other nodes are floors.
+static const char* const sCeilingNodes[] = {
+    "/dev/cpu_freq_max",
+    "/dev/max_online_cpus",
+    "/dev/gpu_freq_max",
+};
+
+static bool isCeilingNode(const char* filename)
+{
+    for (size_t i = 0; i < sizeof(sCeilingNodes) / sizeof(sCeilingNodes[0]); i++) {
+        if (!strcmp(filename, sCeilingNodes[i]))
+            return true;
+    }
+    return false;
+}
+
 TimeoutPoker::TimeoutPoker(Barrier* readyToRun)
 {
     mPokeHandler = new PokeHandler(this, readyToRun);
 }
 
+TimeoutPoker::Command* TimeoutPoker::obtainCommand(int cmd, int type,
+        const char* filename)
+{
+    Command* c = mPokeHandler->mPool.alloc();
+
+    c->cmd = cmd;
+    c->type = type;
+    c->filename = filename;
+    c->val = 0;
+    c->priority = -1;
+    c->max = -1;
+    c->min = -1;
+    c->category = 0;
+    c->timeout = 0;
+    c->outFd = NULL;
+    c->done = NULL;
+    c->task = NULL;
+    return c;
+}
+
 //Called usually from IPC thread
-void TimeoutPoker::pushEvent(QueuedEvent* event)
+void TimeoutPoker::pushCommand(Command* c)
 {
-    mPokeHandler->sendEventDelayed(0, event);
+    if (mPokeHandler->mFailed) {
+        if (c->outFd)
+            *c->outFd = -1;
+        if (c->done)
+            c->done->open();
+        delete c->task;
+        mPokeHandler->mPool.release(c);
+        return;
+    }
+
+    c->enqueued = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (mPokeHandler->mQueue.push(c)) {
+        mPokeHandler->mStats.wakeups.fetch_add(1, std::memory_order_relaxed);
+        mPokeHandler->wake();
+    }
 }
 
-int TimeoutPoker::PokeHandler::createHandleForFd(int fd)
+int TimeoutPoker::PokeHandler::createHandleForFd(int fd, HandleNode* node)
 {
     int pipefd[2];
     int res = pipe(pipefd);
@@ -39,7 +96,7 @@ int TimeoutPoker::PokeHandler::createHandleForFd(int fd)
         return -1;
     }
 
-    listenForHandleToCloseFd(pipefd[SERVER_FD], fd);
+    res = listenForHandleToCloseFd(pipefd[SERVER_FD], fd, node);
     if (res) {
         close(fd);
         close(pipefd[SERVER_FD]);
@@ -47,12 +104,52 @@ int TimeoutPoker::PokeHandler::createHandleForFd(int fd)
         return -1;
     }
 
+    if (node->active++ == 0) {
+        node->heldSince = systemTime(SYSTEM_TIME_MONOTONIC);
+        node->applied++;
+    }
     return pipefd[CLIENT_FD];
 }
 
+TimeoutPoker::HandleNode* TimeoutPoker::PokeHandler::getHandleNode(const char* filename,
+        int type, int priority)
+{
+    for (size_t i = 0; i < mHandleNodes.size(); i++) {
+        HandleNode* node = mHandleNodes[i];
+        if (node->type == type && node->priority == priority &&
+                !strcmp(node->filename, filename))
+            return node;
+    }
+
+    HandleNode* node = new HandleNode();
+    node->filename = filename;
+    node->type = type;
+    node->priority = priority;
+    node->val = node->max = node->min = PM_QOS_DEFAULT_VALUE;
+    node->active = 0;
+    node->heldSince = 0;
+    node->heldTime = 0;
+    node->applied = 0;
+    mHandleNodes.add(node);
+    return node;
+}
+
+// The client closed its end of the handle
+void TimeoutPoker::PokeHandler::releaseHandle(HandleWatch* watch)
+{
+    HandleNode* node = watch->node;
+
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, watch->handle, NULL);
+    close(watch->handle);
+    close(watch->fd);
+    if (--node->active == 0)
+        node->heldTime += systemTime(SYSTEM_TIME_MONOTONIC) - node->heldSince;
+    delete watch;
+}
+
 int TimeoutPoker::PokeHandler::openPmQosNode(const char* filename, int val)
 {
-    int pm_qos_fd = open(filename, O_RDWR);;
+    int pm_qos_fd = powerhal_open(filename, O_RDWR);;
     if (pm_qos_fd < 0) {
         ALOGE("unable to open pm_qos file for %s: %s", filename, strerror(errno));
         return -1;
@@ -63,7 +160,7 @@ int TimeoutPoker::PokeHandler::openPmQosNode(const char* filename, int val)
 
 int TimeoutPoker::PokeHandler::openPmQosNode(const char* filename, int priority, int max, int min)
 {
-    int pm_qos_fd = open(filename, O_RDWR);;
+    int pm_qos_fd = powerhal_open(filename, O_RDWR);;
     if (pm_qos_fd < 0) {
         ALOGE("unable to open pm_qos file for %s: %s", filename, strerror(errno));
         return -1;
@@ -82,7 +179,9 @@ int TimeoutPoker::PokeHandler::createHandleForPmQosRequest(const char* filename,
         return -1;
     }
 
-    return createHandleForFd(fd);
+    HandleNode* node = getHandleNode(filename, NODE_TYPE_DEFAULT, -1);
+    node->val = val;
+    return createHandleForFd(fd, node);
 }
 
 int TimeoutPoker::PokeHandler::createHandleForPmQosRequest(const char* filename, int priority, int max, int min)
@@ -92,7 +191,10 @@ int TimeoutPoker::PokeHandler::createHandleForPmQosRequest(const char* filename,
         return -1;
     }
 
-    return createHandleForFd(fd);
+    HandleNode* node = getHandleNode(filename, NODE_TYPE_PRIORITY, priority);
+    node->max = max;
+    node->min = min;
+    return createHandleForFd(fd, node);
 }
 
 int TimeoutPoker::createPmQosHandle(const char* filename,
@@ -100,31 +202,72 @@ int TimeoutPoker::createPmQosHandle(const char* filename,
 {
     Barrier done;
     int ret;
-    pushEvent(new PmQosOpenHandleEvent(
-                filename, val, &ret, &done));
+    Command* c = obtainCommand(CMD_CREATE_HANDLE, NODE_TYPE_DEFAULT, filename);
+
+    c->val = val;
+    c->outFd = &ret;
+    c->done = &done;
+    pushCommand(c);
 
     done.wait();
     return ret;
 }
 
+void TimeoutPoker::dump(int fd)
+{
+    Barrier done;
+    Command* c = obtainCommand(CMD_DUMP, NODE_TYPE_DEFAULT, NULL);
+
+    c->val = fd;
+    c->done = &done;
+    pushCommand(c);
+
+    done.wait();
+}
+
+void TimeoutPoker::dumpFromTask(int fd)
+{
+    mPokeHandler->dumpNodes(fd);
+}
+
+void TimeoutPoker::postTask(Task* task, nsecs_t delay)
+{
+    Command* c = obtainCommand(CMD_POST_TASK, NODE_TYPE_DEFAULT, NULL);
+
+    c->task = task;
+    c->timeout = delay;
+    pushCommand(c);
+}
+
+void TimeoutPoker::cancelPmQosTimed(int mask)
+{
+    Command* c = obtainCommand(CMD_CANCEL, NODE_TYPE_DEFAULT, NULL);
+
+    c->category = mask;
+    pushCommand(c);
+}
+
+bool TimeoutPoker::hasActiveRequests(int mask)
+{
+    return mPokeHandler->hasActiveRequests(mask);
+}
+
 void TimeoutPoker::requestPmQosTimed(const char* filename,
-        int val, nsecs_t timeout)
+        int val, nsecs_t timeout, int category)
 {
-    pushEvent(new PmQosOpenTimedEvent(
-                filename, val, timeout));
+    Command* c = obtainCommand(CMD_TIMED_REQUEST, NODE_TYPE_DEFAULT, filename);
+
+    c->val = val;
+    c->category = category;
+    c->timeout = timeout;
+    pushCommand(c);
     ALOGV("starting requestPmQosTimed, mNodeName %s, mQosValue %d, timeout %d milliseconds",
             filename, val, int(ns2ms(timeout)));
 }
 
 int TimeoutPoker::requestPmQos(const char* filename, int val)
 {
-    int pm_qos_fd = open(filename, O_RDWR);
-    if (pm_qos_fd < 0) {
-        ALOGE("unable to open pm_qos file for %s: %s", filename, strerror(errno));
-        return -1;
-    }
-    write(pm_qos_fd, &val, sizeof(val));
-    return pm_qos_fd;
+    return mPokeHandler->createHandleForPmQosRequest(filename, val);
 }
 
 int TimeoutPoker::createPmQosHandle(const char* filename,
@@ -132,165 +275,771 @@ int TimeoutPoker::createPmQosHandle(const char* filename,
 {
     Barrier done;
     int ret;
-    pushEvent(new PmQosOpenHandleEvent(
-                filename, priority, max, min, &ret, &done));
+    Command* c = obtainCommand(CMD_CREATE_HANDLE, NODE_TYPE_PRIORITY, filename);
+
+    c->priority = priority;
+    c->max = max;
+    c->min = min;
+    c->outFd = &ret;
+    c->done = &done;
+    pushCommand(c);
 
     done.wait();
     return ret;
 }
 
 void TimeoutPoker::requestPmQosTimed(const char* filename,
-        int priority, int max, int min, nsecs_t timeout)
+        int priority, int max, int min, nsecs_t timeout, int category)
 {
-    pushEvent(new PmQosOpenTimedEvent(
-                filename, priority, max, min, timeout));
+    Command* c = obtainCommand(CMD_TIMED_REQUEST, NODE_TYPE_PRIORITY, filename);
+
+    c->priority = priority;
+    c->max = max;
+    c->min = min;
+    c->category = category;
+    c->timeout = timeout;
+    pushCommand(c);
 }
 
 int TimeoutPoker::requestPmQos(const char* filename, int priority, int max, int min)
 {
-    int pm_qos_fd = open(filename, O_RDWR);
-    if (pm_qos_fd < 0) {
-        ALOGE("unable to open pm_qos file for %s: %s", filename, strerror(errno));
-        return -1;
+    return mPokeHandler->createHandleForPmQosRequest(filename, priority, max, min);
+}
+
+/*
+ * CommandPool
+ */
+static inline uint64_t packFreeHead(uint64_t gen, int index)
+{
+    return (gen << 32) | (uint32_t)(index + 1);
+}
+
+TimeoutPoker::CommandPool::CommandPool() :
+    heapAllocs(0)
+{
+    for (int i = 0; i < COMMAND_POOL_SIZE; i++) {
+        mCommands[i].pooled = true;
+        mNextFree[i].store(i + 1 < COMMAND_POOL_SIZE ? i + 1 : -1,
+                std::memory_order_relaxed);
     }
+    mHead.store(packFreeHead(0, 0), std::memory_order_release);
+}
 
-    char command[COMMAND_SIZE];
-    int size = createConstraintCommand((char*)command, COMMAND_SIZE, priority, max, min);
+TimeoutPoker::Command* TimeoutPoker::CommandPool::alloc()
+{
+    uint64_t head = mHead.load(std::memory_order_acquire);
 
-    write(pm_qos_fd, command, size);
-    return pm_qos_fd;
+    for (;;) {
+        int index = (int)(head & 0xffffffff) - 1;
+        if (index < 0)
+            break;
+
+        int next = mNextFree[index].load(std::memory_order_relaxed);
+        if (mHead.compare_exchange_weak(head, packFreeHead((head >> 32) + 1, next),
+                std::memory_order_acq_rel, std::memory_order_acquire))
+            return &mCommands[index];
+    }
+
+    // Pool exhausted by a burst: do not drop the hint
+    heapAllocs.fetch_add(1, std::memory_order_relaxed);
+    Command* c = new Command();
+    c->pooled = false;
+    return c;
+}
+
+void TimeoutPoker::CommandPool::release(Command* c)
+{
+    if (!c->pooled) {
+        delete c;
+        return;
+    }
+
+    int index = c - mCommands;
+    uint64_t head = mHead.load(std::memory_order_acquire);
+
+    do {
+        mNextFree[index].store((int)(head & 0xffffffff) - 1, std::memory_order_relaxed);
+    } while (!mHead.compare_exchange_weak(head, packFreeHead((head >> 32) + 1, index),
+                std::memory_order_acq_rel, std::memory_order_acquire));
 }
 
 /*
- * PokeHandler
+ * CommandQueue
  */
-void TimeoutPoker::PokeHandler::sendEventDelayed(
-        nsecs_t delay, TimeoutPoker::QueuedEvent* ev) {
-    Mutex::Autolock _l(mEvLock);
+TimeoutPoker::CommandQueue::CommandQueue() :
+    mTail(&mStub)
+{
+    mStub.next.store(NULL, std::memory_order_relaxed);
+    mHead.store(&mStub, std::memory_order_relaxed);
+    mPending.store(0, std::memory_order_relaxed);
+}
 
-    int key = generateNewKey();
-    mQueuedEvents.add(key, ev);
-    mWorker->mLooper->sendMessageDelayed(delay, this, key);
+void TimeoutPoker::CommandQueue::link(Command* c)
+{
+    c->next.store(NULL, std::memory_order_relaxed);
+    Command* prev = mHead.exchange(c, std::memory_order_acq_rel);
+    prev->next.store(c, std::memory_order_release);
+}
+
+bool TimeoutPoker::CommandQueue::push(Command* c)
+{
+    link(c);
+    return mPending.fetch_add(1, std::memory_order_acq_rel) == 0;
 }
 
-TimeoutPoker::QueuedEvent*
-TimeoutPoker::PokeHandler::removeEventByKey(
-int what) {
-    Mutex::Autolock _l(mEvLock);
+// Consumer side, scheduler thread only
+TimeoutPoker::Command* TimeoutPoker::CommandQueue::pop()
+{
+    Command* tail = mTail;
+    Command* next = tail->next.load(std::memory_order_acquire);
+
+    if (tail == &mStub) {
+        if (!next)
+            return NULL;
+        mTail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        mTail = next;
+        return tail;
+    }
+
+    // A producer is between the exchange and the link, retry later
+    if (tail != mHead.load(std::memory_order_acquire))
+        return NULL;
+
+    link(&mStub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        mTail = next;
+        return tail;
+    }
 
-    // msg.what contains a key to retrieve the message parameters
-    TimeoutPoker::QueuedEvent* e =
-        mQueuedEvents.valueFor(what);
-    mQueuedEvents.removeItem(what);
-    return e;
+    return NULL;
 }
 
-int TimeoutPoker::PokeHandler::generateNewKey(void)
+bool TimeoutPoker::CommandQueue::done(int count)
 {
-    return mKey++;
+    return mPending.fetch_sub(count, std::memory_order_acq_rel) != count;
 }
 
+/*
+ * TimerHeap
+ */
+void TimeoutPoker::TimerHeap::swap(int a, int b)
+{
+    TimerEntry* e = mHeap[a];
+
+    mHeap.editItemAt(a) = mHeap[b];
+    mHeap.editItemAt(b) = e;
+    mHeap[a]->heapIndex = a;
+    mHeap[b]->heapIndex = b;
+}
+
+void TimeoutPoker::TimerHeap::siftUp(int i)
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (mHeap[parent]->deadline <= mHeap[i]->deadline)
+            break;
+        swap(i, parent);
+        i = parent;
+    }
+}
+
+void TimeoutPoker::TimerHeap::siftDown(int i)
+{
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        int size = mHeap.size();
+
+        if (left < size && mHeap[left]->deadline < mHeap[smallest]->deadline)
+            smallest = left;
+        if (right < size && mHeap[right]->deadline < mHeap[smallest]->deadline)
+            smallest = right;
+        if (smallest == i)
+            break;
+        swap(i, smallest);
+        i = smallest;
+    }
+}
+
+void TimeoutPoker::TimerHeap::update(TimerEntry* e, nsecs_t deadline)
+{
+    e->deadline = deadline;
+
+    if (e->heapIndex < 0)
+        e->heapIndex = mHeap.add(e);
+
+    siftUp(e->heapIndex);
+    siftDown(e->heapIndex);
+}
+
+void TimeoutPoker::TimerHeap::remove(TimerEntry* e)
+{
+    int i = e->heapIndex;
+
+    if (i < 0)
+        return;
+
+    int last = mHeap.size() - 1;
+    if (i != last)
+        swap(i, last);
+    mHeap.removeAt(last);
+    if (i != last) {
+        TimerEntry* moved = mHeap[i];
+        siftUp(i);
+        siftDown(moved->heapIndex);
+    }
+    e->heapIndex = -1;
+}
+
+/*
+ * PokeHandler
+ */
 TimeoutPoker::PokeHandler::PokeHandler(TimeoutPoker* poker, Barrier* readyToRun) :
+    mFailed(false),
     mPoker(poker),
-    mKey(0),
-    mSpamRefresh(false)
+    mEpollFd(-1),
+    mWakeFd(-1),
+    mTimerFd(-1),
+    mArmedDeadline(0)
 {
-    mWorker = new LooperThread(readyToRun);
-    mWorker->run("TimeoutPoker::PokeHandler::LooperThread", PRIORITY_FOREGROUND);
+    mWorker = new SchedulerThread(this, readyToRun);
+    mWorker->run("TimeoutPoker::PokeHandler::SchedulerThread", PRIORITY_FOREGROUND);
     readyToRun->wait();
 }
 
-void TimeoutPoker::PokeHandler::handleMessage(const Message& msg)
+status_t TimeoutPoker::PokeHandler::init()
+{
+    struct epoll_event ev;
+
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    mWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (mEpollFd < 0 || mWakeFd < 0 || mTimerFd < 0) {
+        ALOGE("unable to create scheduler fds: %s", strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &mWakeFd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &ev))
+        return UNKNOWN_ERROR;
+    ev.data.ptr = &mTimerFd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTimerFd, &ev))
+        return UNKNOWN_ERROR;
+
+    return NO_ERROR;
+}
+
+void TimeoutPoker::PokeHandler::wake()
 {
-    assert(!mQueuedEvents->isEmpty());
+    uint64_t one = 1;
+
+    write(mWakeFd, &one, sizeof(one));
+}
 
-    // msg.what contains a key to retrieve the message parameters
-    TimeoutPoker::QueuedEvent* e =
-        removeEventByKey(msg.what);
+void TimeoutPoker::PokeHandler::pollOnce()
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    uint64_t count;
+    int n;
 
-    if (!e)
+    n = epoll_wait(mEpollFd, events, MAX_EPOLL_EVENTS, -1);
+    mStats.syscalls++;
+    if (n < 0) {
+        if (errno != EINTR)
+            ALOGE("epoll_wait failed: %s", strerror(errno));
         return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        void* ptr = events[i].data.ptr;
 
-    e->run(this);
+        if (ptr == &mWakeFd) {
+            read(mWakeFd, &count, sizeof(count));
+            mStats.syscalls++;
+            runCommands();
+        } else if (ptr == &mTimerFd) {
+            read(mTimerFd, &count, sizeof(count));
+            mStats.syscalls++;
+            mArmedDeadline = 0;
+            runTimers();
+        } else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+            releaseHandle((HandleWatch*)ptr);
+        }
+    }
 
-    delete e;
+    armTimer();
 }
 
-void TimeoutPoker::PokeHandler::openPmQosTimed(const char* filename,
-        int val, nsecs_t timeout)
+void TimeoutPoker::PokeHandler::runCommands()
 {
-    int fd = openPmQosNode(filename, val);
-    if (fd < 0) {
+    int count;
+
+    do {
+        Command* c;
+
+        count = 0;
+        while ((c = mQueue.pop()) != NULL) {
+            runCommand(c);
+            count++;
+        }
+    } while (mQueue.done(count));
+}
+
+void TimeoutPoker::PokeHandler::runCommand(Command* c)
+{
+    switch (c->cmd) {
+    case CMD_TIMED_REQUEST:
+        if (c->type == NODE_TYPE_PRIORITY)
+            addTimedRequest(c->filename, c->priority, c->max, c->min, c->timeout, c->category);
+        else
+            addTimedRequest(c->filename, c->val, c->timeout, c->category);
+        recordLatency(systemTime(SYSTEM_TIME_MONOTONIC) - c->enqueued);
+        break;
+    case CMD_CREATE_HANDLE:
+        if (c->type == NODE_TYPE_PRIORITY)
+            *c->outFd = createHandleForPmQosRequest(c->filename, c->priority, c->max, c->min);
+        else
+            *c->outFd = createHandleForPmQosRequest(c->filename, c->val);
+        recordLatency(systemTime(SYSTEM_TIME_MONOTONIC) - c->enqueued);
+        c->done->open();
+        break;
+    case CMD_DUMP:
+        dumpNodes(c->val);
+        c->done->open();
+        break;
+    case CMD_POST_TASK:
+        addTask(c->task, c->timeout);
+        break;
+    case CMD_CANCEL:
+        cancelRequests(c->category);
+        break;
+    }
+
+    mPool.release(c);
+}
+
+void TimeoutPoker::PokeHandler::runTimers()
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    TimerEntry* e;
+
+    while ((e = mTimers.top()) != NULL && e->deadline <= now) {
+        mTimers.remove(e);
+        e->expire(this, now);
+    }
+}
+
+// Only touches the timerfd when the earliest deadline changed
+void TimeoutPoker::PokeHandler::armTimer()
+{
+    TimerEntry* e = mTimers.top();
+    nsecs_t deadline = e ? e->deadline : 0;
+    struct itimerspec its;
+
+    if (deadline == mArmedDeadline)
+        return;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline / 1000000000LL;
+    its.it_value.tv_nsec = deadline % 1000000000LL;
+    mStats.syscalls++;
+    if (timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &its, NULL)) {
+        ALOGE("timerfd_settime failed: %s", strerror(errno));
         return;
     }
+    mArmedDeadline = deadline;
+}
 
-    sendEventDelayed(timeout, new TimeoutEvent(fd));
+void TimeoutPoker::PokeHandler::addTimedRequest(const char* filename,
+        int val, nsecs_t timeout, int category)
+{
+    addRequest(getNode(filename, NODE_TYPE_DEFAULT, -1), val, -1, -1, timeout, category);
 }
 
-void TimeoutPoker::PokeHandler::openPmQosTimed(const char* filename,
-        int priority, int max, int min,  nsecs_t timeout)
+void TimeoutPoker::PokeHandler::addTimedRequest(const char* filename,
+        int priority, int max, int min,  nsecs_t timeout, int category)
 {
-    int fd = openPmQosNode(filename, priority, max, min);
-    if (fd < 0) {
+    addRequest(getNode(filename, NODE_TYPE_PRIORITY, priority), 0, max, min, timeout, category);
+}
+
+TimeoutPoker::PmQosNode* TimeoutPoker::PokeHandler::getNode(const char* filename,
+        int type, int priority)
+{
+    for (size_t i = 0; i < mNodes.size(); i++) {
+        PmQosNode* node = mNodes[i];
+        if (node->type == type && node->priority == priority &&
+                !strcmp(node->filename, filename))
+            return node;
+    }
+
+    PmQosNode* node = new PmQosNode();
+    node->filename = filename;
+    node->type = type;
+    node->priority = priority;
+    node->lowestWins = isCeilingNode(filename);
+    node->fd = -1;
+    node->val = node->max = node->min = PM_QOS_DEFAULT_VALUE;
+    node->numRequests = 0;
+    node->heldSince = 0;
+    node->heldTime = 0;
+    node->applied = 0;
+    mNodes.add(node);
+    return node;
+}
+
+void TimeoutPoker::PokeHandler::addRequest(PmQosNode* node,
+        int val, int max, int min, nsecs_t timeout, int category)
+{
+    nsecs_t expiry = systemTime(SYSTEM_TIME_MONOTONIC) + timeout;
+    int slot = 0;
+
+    for (int i = 0; i < node->numRequests; i++) {
+        PmQosRequest& req = node->requests[i];
+        if (req.val == val && req.max == max && req.min == min &&
+                req.category == category) {
+            // Same request still active: extend it in place, the node
+            // timer re-arms for it when it fires.
+            if (expiry > req.expiry)
+                req.expiry = expiry;
+            return;
+        }
+        if (req.expiry < node->requests[slot].expiry)
+            slot = i;
+    }
+
+    if (node->numRequests < MAX_NODE_REQUESTS) {
+        slot = node->numRequests++;
+    } else {
+        ALOGW("too many requests on %s, dropping the oldest", node->filename);
+    }
+
+    PmQosRequest req = { val, max, min, category, expiry };
+    node->requests[slot] = req;
+    applyNode(node);
+    scheduleTimeout(node);
+}
+
+void TimeoutPoker::PokeHandler::cancelRequests(int mask)
+{
+    for (size_t i = 0; i < mNodes.size(); i++) {
+        PmQosNode* node = mNodes[i];
+        int count = node->numRequests;
+
+        for (int j = node->numRequests; j > 0; j--) {
+            if (node->requests[j - 1].category & mask)
+                node->requests[j - 1] = node->requests[--node->numRequests];
+        }
+
+        if (node->numRequests != count) {
+            applyNode(node);
+            scheduleTimeout(node);
+        }
+    }
+
+    for (size_t i = mTasks.size(); i > 0; i--) {
+        TaskTimer* timer = mTasks[i - 1];
+
+        if (timer->task->category & mask) {
+            mTimers.remove(timer);
+            mTasks.removeAt(i - 1);
+            delete timer->task;
+            delete timer;
+        }
+    }
+}
+
+// Writes the aggregate of the active requests, opening the node on the
+// first request and closing it once none is left.
+void TimeoutPoker::PokeHandler::applyNode(PmQosNode* node)
+{
+    int val = PM_QOS_DEFAULT_VALUE;
+    int max = PM_QOS_DEFAULT_VALUE;
+    int min = PM_QOS_DEFAULT_VALUE;
+
+    if (node->numRequests == 0) {
+        if (node->fd >= 0) {
+            close(node->fd);
+            mStats.syscalls++;
+            node->fd = -1;
+            node->heldTime += systemTime(SYSTEM_TIME_MONOTONIC) - node->heldSince;
+        }
+        return;
+    }
+
+    for (int i = 0; i < node->numRequests; i++) {
+        const PmQosRequest& req = node->requests[i];
+        if (i == 0 || (node->lowestWins ? req.val < val : req.val > val))
+            val = req.val;
+        if (req.max != PM_QOS_DEFAULT_VALUE &&
+                (max == PM_QOS_DEFAULT_VALUE || req.max < max))
+            max = req.max;
+        if (req.min > min)
+            min = req.min;
+    }
+
+    if (node->fd >= 0 && val == node->val && max == node->max && min == node->min)
         return;
+
+    if (node->fd < 0) {
+        node->fd = (node->type == NODE_TYPE_PRIORITY) ?
+            openPmQosNode(node->filename, node->priority, max, min) :
+            openPmQosNode(node->filename, val);
+        // open and write
+        mStats.syscalls += 2;
+        // Retried when the requests of the node change
+        if (node->fd < 0)
+            return;
+        node->heldSince = systemTime(SYSTEM_TIME_MONOTONIC);
+        node->applied++;
+    } else if (node->type == NODE_TYPE_PRIORITY) {
+        char command[COMMAND_SIZE];
+        int size = createConstraintCommand((char*)command, COMMAND_SIZE,
+                node->priority, max, min);
+        write(node->fd, command, size);
+        mStats.syscalls++;
+    } else {
+        write(node->fd, &val, sizeof(val));
+        mStats.syscalls++;
     }
 
-    sendEventDelayed(timeout, new TimeoutEvent(fd));
+    node->val = val;
+    node->max = max;
+    node->min = min;
 }
 
+void TimeoutPoker::PokeHandler::scheduleTimeout(PmQosNode* node)
+{
+    nsecs_t earliest = 0;
 
-void TimeoutPoker::PokeHandler::timeoutRequest(int fd)
+    for (int i = 0; i < node->numRequests; i++) {
+        if (earliest == 0 || node->requests[i].expiry < earliest)
+            earliest = node->requests[i].expiry;
+    }
+
+    if (earliest == 0)
+        mTimers.remove(node);
+    else if (node->heapIndex < 0 || earliest < node->deadline)
+        mTimers.update(node, earliest);
+}
+
+void TimeoutPoker::PokeHandler::timeoutRequests(PmQosNode* node, nsecs_t now)
 {
-    close(fd);
+    for (int i = node->numRequests; i > 0; i--) {
+        if (node->requests[i - 1].expiry <= now)
+            node->requests[i - 1] = node->requests[--node->numRequests];
+    }
+
+    applyNode(node);
+    scheduleTimeout(node);
 }
 
-status_t TimeoutPoker::PokeHandler::LooperThread::readyToRun()
+// Residency of the timed requests, a node is held from a successful open
+// to its close, then of the handles, held from the first open to the
+// last close. Requests that could not open the node are not counted.
+void TimeoutPoker::PokeHandler::dumpNodes(int fd)
 {
-    mLooper = Looper::prepare(0);
-    if (mLooper == 0)
-        return NO_MEMORY;
-    mReadyToRun->open();
-    return NO_ERROR;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    dprintf(fd, "PM QoS residency, timed requests:\n");
+    for (size_t i = 0; i < mNodes.size(); i++) {
+        const PmQosNode* node = mNodes[i];
+        nsecs_t held = node->heldTime;
+
+        if (node->fd >= 0)
+            held += now - node->heldSince;
+        dprintf(fd, "  %s", node->filename);
+        if (node->type == NODE_TYPE_PRIORITY)
+            dprintf(fd, " priority %d: max %d min %d", node->priority, node->max, node->min);
+        else
+            dprintf(fd, ": %d", node->val);
+        dprintf(fd, " %s, held %lld ms over %u periods\n",
+                node->fd >= 0 ? "active" : "idle", (long long)ns2ms(held), node->applied);
+    }
+
+    dprintf(fd, "PM QoS residency, handles:\n");
+    for (size_t i = 0; i < mHandleNodes.size(); i++) {
+        const HandleNode* node = mHandleNodes[i];
+        nsecs_t held = node->heldTime;
+
+        if (node->active)
+            held += now - node->heldSince;
+        dprintf(fd, "  %s", node->filename);
+        if (node->type == NODE_TYPE_PRIORITY)
+            dprintf(fd, " priority %d: max %d min %d", node->priority, node->max, node->min);
+        else
+            dprintf(fd, ": %d", node->val);
+        dprintf(fd, " %s, held %lld ms over %u periods\n",
+                node->active ? "active" : "idle", (long long)ns2ms(held), node->applied);
+    }
+
+    dumpRequestStats(fd);
 }
 
-bool TimeoutPoker::PokeHandler::LooperThread::threadLoop()
+TimeoutPoker::RequestStats::RequestStats() :
+    requests(0),
+    syscalls(0),
+    wakeups(0)
 {
-   int res = mLooper->pollAll(99999);
-   if (res == ALOOPER_POLL_ERROR)
-       ALOGE("Poll returned an error!");
-    return true;
+    memset(latency, 0, sizeof(latency));
 }
 
-class CallbackContext {
-public:
-    CallbackContext(sp<Looper> looper, int fd) : looper(looper), fd(fd) {}
+// Bucket i holds latencies in [2^i, 2^(i+1)) us, the last one everything above
+void TimeoutPoker::PokeHandler::recordLatency(nsecs_t latency)
+{
+    uint64_t us = latency > 0 ? ns2us(latency) : 0;
+    int bucket = 0;
+
+    while (us > 1 && bucket < LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
 
-    sp<Looper> looper;
-    int fd;
-};
+    mStats.latency[bucket]++;
+    mStats.requests++;
+}
 
-static int pipeCloseCb(int handle, int events, void* data)
+// Percentiles are reported as the upper bound of their bucket
+void TimeoutPoker::PokeHandler::dumpRequestStats(int fd)
 {
-    CallbackContext* ctx = (CallbackContext*)data;
+    static const int percentiles[] = { 50, 90, 99 };
+    uint64_t requests = mStats.requests;
+    uint32_t wakeups = mStats.wakeups.load(std::memory_order_relaxed);
+    uint64_t seen = 0;
+    size_t p = 0;
 
-    if (events & (ALOOPER_EVENT_ERROR | ALOOPER_EVENT_HANGUP)) {
+    dprintf(fd, "Request path:\n");
+    dprintf(fd, "  %llu requests, %u wakeups, %u heap allocations\n",
+            (unsigned long long)requests, wakeups,
+            mPool.heapAllocs.load(std::memory_order_relaxed));
+    if (!requests)
+        return;
 
-        ctx->looper->removeFd(handle);
-        close(handle);
-        close(ctx->fd);
-        delete ctx;
-        return 0;
+    // Wakeups are one eventfd write each on the requesting side
+    dprintf(fd, "  syscalls per request %.2f\n",
+            (double)(mStats.syscalls + wakeups) / requests);
+    dprintf(fd, "  enqueue to apply latency (us):");
+    for (int i = 0; i < LATENCY_BUCKETS && p < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        seen += mStats.latency[i];
+        while (p < sizeof(percentiles) / sizeof(percentiles[0]) &&
+                seen * 100 >= requests * percentiles[p]) {
+            if (i == LATENCY_BUCKETS - 1)
+                dprintf(fd, " p%d >= %llu", percentiles[p], 1ULL << i);
+            else
+                dprintf(fd, " p%d < %llu", percentiles[p], 2ULL << i);
+            p++;
+        }
     }
-    return 1;
+    dprintf(fd, "\n  histogram (log2 us):");
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        dprintf(fd, " %u", mStats.latency[i]);
+    dprintf(fd, "\n");
+}
+
+void TimeoutPoker::PokeHandler::addTask(Task* task, nsecs_t delay)
+{
+    TaskTimer* timer = new TaskTimer();
+
+    timer->task = task;
+    mTimers.update(timer, systemTime(SYSTEM_TIME_MONOTONIC) + delay);
+    mTasks.add(timer);
+}
+
+void TimeoutPoker::PokeHandler::runTask(TaskTimer* timer, nsecs_t now)
+{
+    nsecs_t next = timer->task->run(now);
+
+    if (next > 0) {
+        mTimers.update(timer, now + next);
+        return;
+    }
+
+    for (size_t i = 0; i < mTasks.size(); i++) {
+        if (mTasks[i] == timer) {
+            mTasks.removeAt(i);
+            break;
+        }
+    }
+    delete timer->task;
+    delete timer;
+}
+
+bool TimeoutPoker::PokeHandler::hasActiveRequests(int mask)
+{
+    for (size_t i = 0; i < mNodes.size(); i++) {
+        const PmQosNode* node = mNodes[i];
+
+        for (int j = 0; j < node->numRequests; j++) {
+            if (node->requests[j].category & mask)
+                return true;
+        }
+    }
+
+    for (size_t i = 0; i < mTasks.size(); i++) {
+        if (mTasks[i]->task->category & mask)
+            return true;
+    }
+
+    return false;
+}
+
+void TimeoutPoker::TaskTimer::expire(PokeHandler * const thiz, nsecs_t now)
+{
+    thiz->runTask(this, now);
+}
+
+void TimeoutPoker::PmQosNode::expire(PokeHandler * const thiz, nsecs_t now)
+{
+    thiz->timeoutRequests(this, now);
+}
+
+status_t TimeoutPoker::PokeHandler::SchedulerThread::readyToRun()
+{
+    status_t res = mHandler->init();
+
+    // Do not leave the callers of createPmQosHandle() and dump() waiting
+    // on a scheduler that never runs
+    if (res != NO_ERROR) {
+        ALOGE("scheduler thread failed to start, PM QoS requests are dropped");
+        mHandler->mFailed = true;
+        res = -1;
+    }
+    mReadyToRun->open();
+    return res;
+}
+
+bool TimeoutPoker::PokeHandler::SchedulerThread::threadLoop()
+{
+    mHandler->pollOnce();
+    return true;
 }
 
 //Reverse arity of result to match call-site usage
-int TimeoutPoker::PokeHandler::listenForHandleToCloseFd(int handle, int fd)
+int TimeoutPoker::PokeHandler::listenForHandleToCloseFd(int handle, int fd, HandleNode* node)
 {
-    //This func is threadsafe
-    return !mWorker->mLooper->addFd(handle, ALOOPER_POLL_CALLBACK,
-            ALOOPER_EVENT_ERROR | ALOOPER_EVENT_HANGUP,
-            pipeCloseCb, new CallbackContext(mWorker->mLooper, fd));
+    struct epoll_event ev;
+    HandleWatch* watch = new HandleWatch();
+
+    watch->handle = handle;
+    watch->fd = fd;
+    watch->node = node;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLHUP | EPOLLERR;
+    ev.data.ptr = watch;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, handle, &ev)) {
+        delete watch;
+        return 1;
+    }
+    return 0;
 }
 
 int createConstraintCommand(char* command, int size, int priority, int max, int min) {
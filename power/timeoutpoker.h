@@ -13,23 +13,32 @@
 #include <stdint.h>
 #include <sys/types.h>
 
-#include <android/looper.h>
+#include <atomic>
+
 #include <utils/threads.h>
 #include <utils/Errors.h>
-#include <utils/List.h>
-#include <utils/Looper.h>
 #include <utils/Log.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
 
 #include "barrier.h"
 
 #define COMMAND_SIZE 20
 #define NODE_TYPE_DEFAULT 0
 #define NODE_TYPE_PRIORITY 1
+#define PM_QOS_DEFAULT_VALUE -1
+
+// Commands preallocated for the hint path, more are heap allocated
+#define COMMAND_POOL_SIZE 64
+// Distinct requests coalesced on one node
+#define MAX_NODE_REQUESTS 8
+// Enqueue to apply latency histogram, log2 buckets of microseconds
+#define LATENCY_BUCKETS 20
 
-//It seems redundant to need both this message queue
-//And the IPC threads message queue
-//But I didn't see an easy way to
-//run an event after a timeout on the IPC threads
+// Hints arrive on binder threads and are handed to a single scheduler
+// thread through a lock-free queue. The scheduler owns all PM QoS state
+// and sleeps in epoll on an eventfd (new commands), a timerfd armed for
+// the earliest deadline and the pipes behind PM QoS handles.
 
 using namespace android;
 
@@ -47,182 +56,297 @@ public:
     // Uses /dev/[cpu_freq_max, cpu_freq_min, max_online_cpus,
     // min_onlins_cpus, gpu_freq_max, gpu_freq_min] sysnodes which
     // default to priority of 50.
+    //
+    // Timed requests are coalesced per node: the node is held through a
+    // single fd at the strongest active value (highest for *_min nodes,
+    // lowest for *_max nodes) until the last request expires. A request
+    // repeating an active value only extends its expiry.
     int createPmQosHandle(const char* filename, int val);
+    // Same from a Task, on the scheduler thread, where createPmQosHandle()
+    // would wait for itself
     int requestPmQos(const char* filename, int val);
-    void requestPmQosTimed(const char* filename, int val, nsecs_t timeoutNs);
+    void requestPmQosTimed(const char* filename, int val, nsecs_t timeoutNs,
+            int category = 0);
 
     // Interface for requests with a priority parameter.
     // Uses /dev/constraint_[cpu_freq, onlines_cpus, gpu_freq] sysnodes.
     // Command format: "max min priority timeoutMs"
+    // Timed requests are coalesced per node and priority, max or min
+    // set to PM_QOS_DEFAULT_VALUE leave that bound unconstrained.
     int createPmQosHandle(const char* filename, int priority, int max, int min);
+    // From a Task, see above
     int requestPmQos(const char* filename, int priority, int max, int min);
-    void requestPmQosTimed(const char* filename, int priority, int max, int min, nsecs_t timeoutNs);
+    void requestPmQosTimed(const char* filename, int priority, int max, int min, nsecs_t timeoutNs,
+            int category = 0);
+
+    // Timed requests and tasks carry a caller defined category bit.
+    // Drops at once the requests and tasks whose category is in mask,
+    // requests without a category are never cancelled.
+    void cancelPmQosTimed(int mask);
+
+    // Writes the time each node was held, by timed requests and by
+    // handles, and the cost of the request path to fd
+    void dump(int fd);
+    // Same from a Task, on the scheduler thread, where dump() would
+    // wait for itself
+    void dumpFromTask(int fd);
+
+    // Work run on the scheduler thread. run() returns the delay until
+    // its next run, or 0 when done, the poker then deletes the task.
+    class Task {
+    public:
+        Task() : category(0) {}
+        virtual ~Task() {}
+        virtual nsecs_t run(nsecs_t now) = 0;
+
+        int category;
+    };
+
+    void postTask(Task* task, nsecs_t delay);
+
+    // True while a timed request or task of a category in mask is
+    // active. Only valid from a Task, on the scheduler thread.
+    bool hasActiveRequests(int mask);
 
 private:
 
-    class QueuedEvent {
+    enum {
+        CMD_TIMED_REQUEST,
+        CMD_CREATE_HANDLE,
+        CMD_DUMP,
+        CMD_POST_TASK,
+        CMD_CANCEL,
+    };
+
+    // Plain command record, recycled through the pool
+    struct Command {
+        std::atomic<Command*> next;
+        bool pooled;
+        int cmd;
+        int type;
+        const char* filename;
+        int val;
+        int priority;
+        int max;
+        int min;
+        int category;
+        nsecs_t timeout;
+        int* outFd;
+        Barrier* done;
+        Task* task;
+        nsecs_t enqueued;
+    };
+
+    // Fixed arena of commands with a lock-free free list. The head packs
+    // a generation count with the index to rule out ABA on concurrent pops.
+    class CommandPool {
+    public:
+        CommandPool();
+        Command* alloc();
+        void release(Command* c);
+
+        // Commands allocated on the heap because the pool was empty
+        std::atomic<uint32_t> heapAllocs;
+
+    private:
+        Command mCommands[COMMAND_POOL_SIZE];
+        std::atomic<int> mNextFree[COMMAND_POOL_SIZE];
+        std::atomic<uint64_t> mHead;
+    };
+
+    // Intrusive multi-producer single-consumer queue (Vyukov)
+    class CommandQueue {
+    public:
+        CommandQueue();
+        // Returns true when the consumer has to be woken up
+        bool push(Command* c);
+        Command* pop();
+        // Acknowledges popped commands, returns true if more were queued
+        bool done(int count);
+
+    private:
+        void link(Command* c);
+
+        std::atomic<Command*> mHead;
+        Command* mTail;
+        Command mStub;
+        std::atomic<int> mPending;
+    };
+
+    class TimerEntry {
     public:
-        virtual ~QueuedEvent() {}
-        QueuedEvent() { }
+        TimerEntry() : deadline(0), heapIndex(-1) {}
+        virtual ~TimerEntry() {}
+        virtual void expire(PokeHandler * const thiz, nsecs_t now) = 0;
 
-        virtual void run(PokeHandler * const thiz) = 0;
+        nsecs_t deadline;
+        int heapIndex;
     };
 
-    class PmQosOpenTimedEvent : public QueuedEvent {
+    // Binary min-heap of deadlines, each entry appears at most once.
+    // Scheduler thread only, grows with the nodes and tasks.
+    class TimerHeap {
     public:
-        virtual ~PmQosOpenTimedEvent() {}
-        PmQosOpenTimedEvent(const char* node,
-                int val,
-                nsecs_t timeout) :
-            node(node),
-            val(val),
-            timeout(timeout) {
-            type = NODE_TYPE_DEFAULT;
-            priority = -1;
-            max = -1;
-            min = -1;
-        }
-
-        PmQosOpenTimedEvent(const char* node,
-                int priority,
-                int max,
-                int min,
-                nsecs_t timeout) :
-            node(node),
-            priority(priority),
-            max(max),
-            min(min),
-            timeout(timeout) {
-            type = NODE_TYPE_PRIORITY;
-            val = 0;
-        }
-
-        virtual void run(PokeHandler * const thiz) {
-            if (type == NODE_TYPE_PRIORITY) {
-                thiz->openPmQosTimed(node, priority, max, min, timeout);
-            } else {
-                thiz->openPmQosTimed(node, val, timeout);
-            }
-        }
+        void update(TimerEntry* e, nsecs_t deadline);
+        void remove(TimerEntry* e);
+        TimerEntry* top() const { return mHeap.isEmpty() ? NULL : mHeap[0]; }
 
     private:
-        const char* node;
+        void siftUp(int i);
+        void siftDown(int i);
+        void swap(int a, int b);
+
+        Vector<TimerEntry*> mHeap;
+    };
+
+    struct PmQosRequest {
         int val;
-        int priority;
         int max;
         int min;
-        int type;
-        nsecs_t timeout;
+        int category;
+        nsecs_t expiry;
     };
 
-    class PmQosOpenHandleEvent : public QueuedEvent {
+    // Coalesced state of one node (and priority for constraint nodes),
+    // only touched from the scheduler thread.
+    class PmQosNode : public TimerEntry {
     public:
-        virtual ~PmQosOpenHandleEvent() {}
-        PmQosOpenHandleEvent(const char* node,
-                int val,
-                int* outFd,
-                Barrier* done) :
-            node(node),
-            val(val),
-            outFd(outFd),
-            done(done) {
-            type = NODE_TYPE_DEFAULT;
-            priority = -1;
-            max = -1;
-            min = -1;
-        }
-
-        PmQosOpenHandleEvent(const char* node,
-                int priority,
-                int max,
-                int min,
-                int* outFd,
-                Barrier* done) :
-            node(node),
-            priority(priority),
-            max(max),
-            min(min),
-            outFd(outFd),
-            done(done) {
-            type = NODE_TYPE_PRIORITY;
-            val = 0;
-        }
-
-        virtual void run(PokeHandler * const thiz) {
-            if (type == NODE_TYPE_PRIORITY) {
-                *outFd = thiz->createHandleForPmQosRequest(node, priority, max, min);
-            } else {
-                *outFd = thiz->createHandleForPmQosRequest(node, val);
-            }
-            done->open();
-        }
+        virtual void expire(PokeHandler * const thiz, nsecs_t now);
 
-    private:
-        const char* node;
-        int val;
+        const char* filename;
+        int type;
         int priority;
+        bool lowestWins;
+        int fd;
+        int val;
         int max;
         int min;
-        int type;
-        int* outFd;
-        Barrier* done;
+        int numRequests;
+        PmQosRequest requests[MAX_NODE_REQUESTS];
+        // Residency accounting
+        nsecs_t heldSince;
+        nsecs_t heldTime;
+        unsigned int applied;
     };
 
-    class TimeoutEvent : public QueuedEvent {
+    class TaskTimer : public TimerEntry {
     public:
-        virtual ~TimeoutEvent() {}
-        TimeoutEvent(int pmQosFd) : pmQosFd(pmQosFd) {}
+        virtual void expire(PokeHandler * const thiz, nsecs_t now);
 
-        virtual void run(PokeHandler * const thiz) {
-            thiz->timeoutRequest(pmQosFd);
-        }
+        Task* task;
+    };
 
-    private:
-        int pmQosFd;
+    // Residency of the requests held through handles on one node (and
+    // priority for constraint nodes), held while any of them is open.
+    // Scheduler thread only.
+    struct HandleNode {
+        const char* filename;
+        int type;
+        int priority;
+        // Last request
+        int val;
+        int max;
+        int min;
+        int active;
+        nsecs_t heldSince;
+        nsecs_t heldTime;
+        unsigned int applied;
     };
 
-    void pushEvent(QueuedEvent* event);
+    // epoll registration of a PM QoS handle: closing the client end of
+    // the pipe releases the request.
+    struct HandleWatch {
+        int handle;
+        int fd;
+        HandleNode* node;
+    };
+
+    // Cost of the request path. Counted on the scheduler thread but for
+    // the wakeups, which the requesting threads pay for.
+    struct RequestStats {
+        RequestStats();
+
+        uint64_t requests;
+        uint64_t syscalls;
+        uint32_t latency[LATENCY_BUCKETS];
+        std::atomic<uint32_t> wakeups;
+    };
 
-    class PokeHandler : public MessageHandler {
-        class LooperThread : public Thread {
+    Command* obtainCommand(int cmd, int type, const char* filename);
+    void pushCommand(Command* c);
+
+    class PokeHandler : public RefBase {
+        class SchedulerThread : public Thread {
             private:
                 Barrier* mReadyToRun;
+                PokeHandler* mHandler;
             public:
-                sp<Looper> mLooper;
                 virtual bool threadLoop();
-                LooperThread(Barrier* readyToRun) :
-                    mReadyToRun(readyToRun) {}
+                SchedulerThread(PokeHandler* handler, Barrier* readyToRun) :
+                    mReadyToRun(readyToRun),
+                    mHandler(handler) {}
                 virtual status_t readyToRun();
         };
     public:
 
-        sp<LooperThread> mWorker;
+        sp<SchedulerThread> mWorker;
+        // Set before readyToRun opens when the scheduler could not start,
+        // commands are then dropped instead of queued.
+        bool mFailed;
 
-        KeyedVector<unsigned int, QueuedEvent*> mQueuedEvents;
+        CommandPool mPool;
+        CommandQueue mQueue;
 
-        virtual void handleMessage(const Message& msg);
         PokeHandler(TimeoutPoker* poker, Barrier* readyToRun);
-        int generateNewKey(void);
-        void sendEventDelayed(nsecs_t delay, QueuedEvent* ev);
-        int listenForHandleToCloseFd(int handle, int fd);
-        QueuedEvent* removeEventByKey(int key);
-        int createHandleForFd(int fd);
-        void timeoutRequest(int fd);
-
-        void openPmQosTimed(const char* fileName, int val, nsecs_t timeout);
+        status_t init();
+        void wake();
+        void pollOnce();
+        void runCommands();
+        void runCommand(Command* c);
+        void runTimers();
+        void armTimer();
+        int listenForHandleToCloseFd(int handle, int fd, HandleNode* node);
+        int createHandleForFd(int fd, HandleNode* node);
+        HandleNode* getHandleNode(const char* filename, int type, int priority);
+        void releaseHandle(HandleWatch* watch);
+
+        void addTimedRequest(const char* fileName, int val, nsecs_t timeout, int category);
         int createHandleForPmQosRequest(const char* filename, int val);
         int openPmQosNode(const char* filename, int val);
 
-        void openPmQosTimed(const char* fileName, int priority, int max, int min, nsecs_t timeout);
+        void addTimedRequest(const char* fileName, int priority, int max, int min, nsecs_t timeout,
+                int category);
         int createHandleForPmQosRequest(const char* filename, int priority, int max, int min);
         int openPmQosNode(const char* filename, int prioirity, int max, int min);
 
+        PmQosNode* getNode(const char* filename, int type, int priority);
+        void addRequest(PmQosNode* node, int val, int max, int min, nsecs_t timeout,
+                int category);
+        void cancelRequests(int mask);
+        void applyNode(PmQosNode* node);
+        void scheduleTimeout(PmQosNode* node);
+        void timeoutRequests(PmQosNode* node, nsecs_t now);
+        void dumpNodes(int fd);
+        void addTask(Task* task, nsecs_t delay);
+        void runTask(TaskTimer* timer, nsecs_t now);
+        bool hasActiveRequests(int mask);
+        void recordLatency(nsecs_t latency);
+        void dumpRequestStats(int fd);
+
+        RequestStats mStats;
+
     private:
         TimeoutPoker* mPoker;
-        int mKey;
 
-        bool mSpamRefresh;
-        mutable Mutex mEvLock;
+        int mEpollFd;
+        int mWakeFd;
+        int mTimerFd;
+        nsecs_t mArmedDeadline;
+        TimerHeap mTimers;
+
+        Vector<PmQosNode*> mNodes;
+        Vector<HandleNode*> mHandleNodes;
+        Vector<TaskTimer*> mTasks;
     };
 
     sp<PokeHandler> mPokeHandler;